@@ -0,0 +1,159 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "data-types.h"
+#include "inputs.h"
+
+/*
+ * Binary table format (version 1), produced by ConvertInput:
+ *
+ *   [BinaryTableHeader][pad] [n0 x row_t][pad] [n1 x row_t]
+ *
+ * Both tables start at page-aligned offsets and are stored exactly as the
+ * text loader would have produced them, so OblRadix maps the file with
+ * MAP_PRIVATE and points R.tuples/S.tuples into the mapping: no parse and no
+ * memcpy. The rows are faulted in writable right away, slice by slice, so the
+ * private copy of every page is made once, by the thread that will work on it.
+ */
+
+#define BINARY_TABLE_MAGIC "OBLRDXTB"
+#define BINARY_TABLE_VERSION 1
+#define BINARY_TABLE_ALIGN 4096
+
+/* row_t layouts; the FK and NFK pipelines use different rows */
+#define ROW_LAYOUT_FK 1  /* key, cntSelf, hashKey, idx, paySelf, payPrimary */
+#define ROW_LAYOUT_NFK 2 /* key, cntSelf, cntExpand, hashKey, idx, pay */
+#define ROW_LAYOUT ROW_LAYOUT_FK
+
+/* both tables are sorted by key; the initial oblivious sort can be skipped */
+#define BINARY_TABLE_SORTED 0x1u
+
+struct BinaryTableHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t headerSize;
+  std::uint32_t rowSize;
+  std::uint32_t dataLength;
+  std::uint32_t rowLayout;
+  std::uint32_t flags;
+  std::uint64_t n0, n1;
+  std::uint64_t offset0, offset1;
+};
+
+inline std::uint64_t binary_table_align(std::uint64_t off) {
+  return (off + BINARY_TABLE_ALIGN - 1) & ~std::uint64_t(BINARY_TABLE_ALIGN - 1);
+}
+
+// returns true if the file starts with the binary table magic
+inline bool is_binary_tables(const std::string &path) {
+  char magic[8];
+  std::ifstream in(path, std::ios::binary);
+  return in.read(magic, sizeof(magic)) &&
+         std::memcmp(magic, BINARY_TABLE_MAGIC, sizeof(magic)) == 0;
+}
+
+// Maps a binary table file privately and points table0/table1 into it.
+// flags receives the header flags (e.g. BINARY_TABLE_SORTED).
+inline bool map_two_tables(const std::string &path, table_t &table0,
+                           table_t &table1, std::uint32_t &flags,
+                           unsigned numThreads) {
+  table0 = table_t{};
+  table1 = table_t{};
+
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    std::cerr << "Error: cannot open \"" << path << "\"\n";
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+
+  BinaryTableHeader hdr;
+  const std::uint64_t fileLen = static_cast<std::uint64_t>(st.st_size);
+  if (fileLen < sizeof(hdr) || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+      std::memcmp(hdr.magic, BINARY_TABLE_MAGIC, sizeof(hdr.magic)) != 0) {
+    std::cerr << "Error: \"" << path << "\" is not a binary table file\n";
+    close(fd);
+    return false;
+  }
+  if (hdr.version != BINARY_TABLE_VERSION || hdr.rowSize != sizeof(row_t) ||
+      hdr.dataLength != DATA_LENGTH || hdr.rowLayout != ROW_LAYOUT) {
+    std::cerr << "Error: \"" << path << "\" has version " << hdr.version
+              << ", row layout " << hdr.rowLayout << " (" << hdr.rowSize
+              << " B rows, DATA_LENGTH " << hdr.dataLength
+              << "); this build expects version " << BINARY_TABLE_VERSION
+              << ", row layout " << ROW_LAYOUT << " (" << sizeof(row_t)
+              << " B rows, DATA_LENGTH " << DATA_LENGTH << ")\n";
+    close(fd);
+    return false;
+  }
+  const std::uint64_t end0 = hdr.offset0 + hdr.n0 * sizeof(row_t);
+  const std::uint64_t end1 = hdr.offset1 + hdr.n1 * sizeof(row_t);
+  if (hdr.offset0 < hdr.headerSize || hdr.offset1 < end0 || end1 > fileLen ||
+      hdr.offset0 % alignof(row_t) || hdr.offset1 % alignof(row_t)) {
+    std::cerr << "Error: \"" << path << "\" is truncated or corrupt\n";
+    close(fd);
+    return false;
+  }
+
+  void *map = mmap(nullptr, fileLen, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    std::cerr << "Error: cannot map \"" << path << "\"\n";
+    return false;
+  }
+
+  char *base = static_cast<char *>(map);
+  table0.tuples = reinterpret_cast<row_t *>(base + hdr.offset0);
+  table0.num_tuples = hdr.n0;
+  table1.tuples = reinterpret_cast<row_t *>(base + hdr.offset1);
+  table1.num_tuples = hdr.n1;
+  populate_two_tables(table0, table1, numThreads);
+  flags = hdr.flags;
+  return true;
+}
+
+// Writes table0/table1 in the binary table format.
+inline bool write_two_tables(const std::string &path, const table_t &table0,
+                             const table_t &table1, std::uint32_t flags) {
+  BinaryTableHeader hdr{};
+  std::memcpy(hdr.magic, BINARY_TABLE_MAGIC, sizeof(hdr.magic));
+  hdr.version = BINARY_TABLE_VERSION;
+  hdr.headerSize = sizeof(hdr);
+  hdr.rowSize = sizeof(row_t);
+  hdr.dataLength = DATA_LENGTH;
+  hdr.rowLayout = ROW_LAYOUT;
+  hdr.flags = flags;
+  hdr.n0 = table0.num_tuples;
+  hdr.n1 = table1.num_tuples;
+  hdr.offset0 = binary_table_align(sizeof(hdr));
+  hdr.offset1 = binary_table_align(hdr.offset0 + hdr.n0 * sizeof(row_t));
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    std::cerr << "Error: cannot create \"" << path << "\"\n";
+    return false;
+  }
+  static const char zeros[BINARY_TABLE_ALIGN] = {};
+  out.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+  out.write(zeros, hdr.offset0 - sizeof(hdr));
+  out.write(reinterpret_cast<const char *>(table0.tuples),
+            hdr.n0 * sizeof(row_t));
+  out.write(zeros, hdr.offset1 - hdr.offset0 - hdr.n0 * sizeof(row_t));
+  out.write(reinterpret_cast<const char *>(table1.tuples),
+            hdr.n1 * sizeof(row_t));
+  if (!out.flush()) {
+    std::cerr << "Error: failed writing \"" << path << "\"\n";
+    return false;
+  }
+  return true;
+}
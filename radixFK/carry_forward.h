@@ -1,9 +1,10 @@
 #pragma once
 #include "inputs.h"
+#include "parallel_for.h"
 #include "slice_utils.h"
 #include <algorithm>
+#include <functional>
 #include <immintrin.h>
-#include <thread>
 #include <vector>
 
 using std::vector;
@@ -11,8 +12,11 @@ using std::vector;
 // Global timers defined in main.cpp
 extern std::chrono::high_resolution_clock::time_point tStart, tEnd;
 
-inline void carryForwardParallel(table_t &tbl,
-                                 const std::vector<Slice> &slices) {
+// onSliceDone(t, slices[t]), if given, is called by the thread of slice t as
+// soon as that slice holds its final rows (e.g. to stream it to the output).
+inline void carryForwardParallel(
+    table_t &tbl, const std::vector<Slice> &slices,
+    const std::function<void(std::size_t, const Slice &)> &onSliceDone = {}) {
   const std::uint32_t N = tbl.num_tuples;
   if (N == 0)
     return;
@@ -30,25 +34,19 @@ inline void carryForwardParallel(table_t &tbl,
   auto &seed = seedScratch;
 
   struct row_t *tblTuples = tbl.tuples;
-  std::vector<std::thread> pool;
-  pool.reserve(P);
-  for (std::size_t t = 0; t < P; ++t) {
-    pool.emplace_back([=, &tblTuples, &last]() {
-      const Slice &sl = slices[t];
-      Record cur{};
-      for (std::size_t i = sl.begin; i < sl.end; ++i) {
-        if (i + 16 < sl.end)
-          _mm_prefetch(reinterpret_cast<const char *>(&tblTuples[i + 16]),
-                       _MM_HINT_T0);
-        std::uint64_t isReal = -(tblTuples[i].cntSelf != 0);
-        maskedCopyRecord32(reinterpret_cast<const Record *>(&tblTuples[i]),
-                           &cur, isReal);
-      }
-      last[t] = cur;
-    });
-  }
-  for (auto &th : pool)
-    th.join();
+  parallelFor(P, [=, &tblTuples, &last](std::size_t t) {
+    const Slice &sl = slices[t];
+    Record cur{};
+    for (std::size_t i = sl.begin; i < sl.end; ++i) {
+      if (i + 16 < sl.end)
+        _mm_prefetch(reinterpret_cast<const char *>(&tblTuples[i + 16]),
+                     _MM_HINT_T0);
+      std::uint64_t isReal = -(tblTuples[i].cntSelf != 0);
+      maskedCopyRecord32(reinterpret_cast<const Record *>(&tblTuples[i]),
+                         &cur, isReal);
+    }
+    last[t] = cur;
+  });
 
   Record running{};
   for (int t = 0; t < P; ++t) {
@@ -58,28 +56,23 @@ inline void carryForwardParallel(table_t &tbl,
                        has);
   }
 
-  pool.clear();
-  pool.reserve(P);
-  for (std::size_t t = 0; t < P; ++t) {
-    pool.emplace_back([=, &tblTuples, &seed]() {
-      const Slice &sl = slices[t];
-      Record cur = seed[t];
-      for (std::size_t i = sl.begin; i < sl.end; ++i) {
-        if (i + 16 < sl.end)
-          _mm_prefetch(reinterpret_cast<const char *>(&tblTuples[i + 16]),
-                       _MM_HINT_T0);
-        std::uint64_t isReal = -(tblTuples[i].cntSelf != 0);
-
-        maskedCopyRecord32(reinterpret_cast<const Record *>(&tblTuples[i]),
-                           &cur, isReal);
-        maskedCopyRecord32(&cur, reinterpret_cast<Record *>(&tblTuples[i]),
-                           std::numeric_limits<std::uint64_t>::max());
-      }
-    });
-  }
+  parallelFor(P, [=, &tblTuples, &seed, &onSliceDone](std::size_t t) {
+    const Slice &sl = slices[t];
+    Record cur = seed[t];
+    for (std::size_t i = sl.begin; i < sl.end; ++i) {
+      if (i + 16 < sl.end)
+        _mm_prefetch(reinterpret_cast<const char *>(&tblTuples[i + 16]),
+                     _MM_HINT_T0);
+      std::uint64_t isReal = -(tblTuples[i].cntSelf != 0);
 
-  for (auto &th : pool)
-    th.join();
+      maskedCopyRecord32(reinterpret_cast<const Record *>(&tblTuples[i]),
+                         &cur, isReal);
+      maskedCopyRecord32(&cur, reinterpret_cast<Record *>(&tblTuples[i]),
+                         std::numeric_limits<std::uint64_t>::max());
+    }
+    if (onSliceDone)
+      onSliceDone(t, sl);
+  });
 
   tEnd = std::chrono::high_resolution_clock::now();
 }
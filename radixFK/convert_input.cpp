@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "binary_tables.h"
+#include "inputs.h"
+
+// Converts a text input file (see README) into the binary table format that
+// OblRadix maps directly. With --sort both tables are stably sorted by key
+// (and renumbered) first, like sort_tables.py.
+
+static bool sortedByKey(const table_t &tbl) {
+  for (std::uint64_t i = 1; i < tbl.num_tuples; ++i)
+    if (tbl.tuples[i].key < tbl.tuples[i - 1].key)
+      return false;
+  return true;
+}
+
+static void sortByKey(table_t &tbl) {
+  // idx is the input position, so (key, idx) order is the stable key order
+  std::sort(tbl.tuples, tbl.tuples + tbl.num_tuples,
+            [](const row_t &a, const row_t &b) {
+              return a.key < b.key || (a.key == b.key && a.idx < b.idx);
+            });
+  for (std::uint64_t i = 0; i < tbl.num_tuples; ++i)
+    tbl.tuples[i].idx = static_cast<std::uint32_t>(i);
+}
+
+int main(int argc, char *argv[]) {
+  bool sort = false;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == "--sort")
+      sort = true;
+    else
+      args.emplace_back(argv[i]);
+  }
+  if (args.size() < 2 || args.size() > 3) {
+    std::cerr << "Usage: ConvertInput [--sort] <input_file> <output_file> "
+                 "[num_threads]"
+              << std::endl;
+    return 1;
+  }
+  const std::string &inputPath = args[0];
+  const std::string &outputPath = args[1];
+  unsigned numThreads = std::max(1u, std::thread::hardware_concurrency());
+  if (args.size() > 2)
+    numThreads = std::max<unsigned>(1, std::stoul(args[2]));
+
+  worker_pool_init(numThreads);
+  std::atexit(worker_pool_shutdown);
+
+  table_t t0, t1;
+  if (!load_two_tables(inputPath, t0, t1, numThreads))
+    return 1;
+
+  if (sort) {
+    sortByKey(t0);
+    sortByKey(t1);
+  }
+  std::uint32_t flags =
+      (sortedByKey(t0) && sortedByKey(t1)) ? BINARY_TABLE_SORTED : 0;
+
+  if (!write_two_tables(outputPath, t0, t1, flags))
+    return 1;
+
+  printf("Wrote %s: n0 = %lu, n1 = %lu, %s\n", outputPath.c_str(),
+         t0.num_tuples, t1.num_tuples,
+         (flags & BINARY_TABLE_SORTED) ? "sorted" : "unsorted");
+  return 0;
+}
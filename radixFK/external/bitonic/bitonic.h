@@ -5,14 +5,72 @@
 #include <stddef.h>
 //#include "common/defs.h"
 #include "elem_t.h"
+#include "threading.h"
+
+/*
+ * Oblivious sort run by a sorter:
+ *
+ *   SORT_BITONIC  bitonic sort, O(n log^2 n) comparators, in place
+ *   SORT_BUCKET   bucket oblivious sort (bucket_sort.h), O(n log n) work,
+ *                 4.5n to 7n rows of scratch space
+ *   SORT_SHUFFLE  oblivious shuffle (bucket_shuffle_) followed by a parallel
+ *                 samplesort (sample_sort.h)
+ *   SORT_TAG      oblivious shuffle, then a bitonic sort of 16-byte tags
+ *                 and one gather of the rows (tag_sort.h)
+ */
+enum sort_engine {
+    SORT_BITONIC,
+    SORT_BUCKET,
+    SORT_SHUFFLE,
+    SORT_TAG,
+};
+
+/* engine of the sorters set up from now on, SORT_BITONIC unless set */
+void set_sort_engine(enum sort_engine engine);
+enum sort_engine get_sort_engine(void);
+const char *sort_engine_name(enum sort_engine engine);
+
+/*
+ * One sort: the array it works on, the comparator mode and the number of
+ * threads it may split into. The sort keeps no other state, so several
+ * sorters can run at the same time on one thread system.
+ */
+struct bitonic_sorter {
+    elem_t *arr;
+    int num_threads;
+    bool dimension2D; /* order equal keys by idx */
+    enum sort_engine engine;
+};
 
 struct bitonic_sort_new_args {
+    const struct bitonic_sorter *sorter;
     bool ascend;
     int lo;
     int hi;
     int number_threads;
 };
 
+/* a sort handed to the work list by bitonic_sorter_start */
+struct bitonic_job {
+    struct bitonic_sort_new_args args;
+    struct thread_work work;
+};
+
+/* sets up a sorter for the current get_sort_engine() */
+void bitonic_sorter_init(struct bitonic_sorter *sorter, elem_t *arr,
+        int num_threads, bool D2enable);
+
+/* Sorts arr[lo, hi) on the calling thread and the thread system's workers. */
+void bitonic_sorter_sort(const struct bitonic_sorter *sorter, bool ascend,
+        int lo, int hi);
+
+/* Pushes the sort of arr[lo, hi) to the work list and returns; the sorter and
+   the job must stay alive until bitonic_sorter_wait(job) returns. */
+void bitonic_sorter_start(struct bitonic_job *job,
+        const struct bitonic_sorter *sorter, bool ascend, int lo, int hi);
+void bitonic_sorter_wait(struct bitonic_job *job);
+
+/* bitonic sort of arr_[lo, hi), whatever the engine setting */
 void bitonic_sort_(elem_t *arr_, bool ascend , int lo, int hi, int num_threads, bool D2enable);
 
 #endif /* distributed-sgx-sort/enclave/bitonic.h */
@@ -0,0 +1,19 @@
+#ifndef SAMPLE_SORT_H
+#define SAMPLE_SORT_H
+
+#include <stdbool.h>
+#include "elem_t.h"
+
+/*
+ * Parallel samplesort of arr[lo, hi) by (key, idx) with num_threads threads
+ * of the thread system. Not oblivious: its accesses follow the comparisons,
+ * so it may only run on rows in a secret random order, e.g. right after
+ * bucket_shuffle_, and (key, idx) must be unique. Then the comparisons are
+ * those of a random permutation and reveal nothing about the keys.
+ */
+void sample_sort_(elem_t *arr, bool ascend, int lo, int hi, int num_threads);
+
+/* bucket_shuffle_ followed by sample_sort_ */
+void shuffle_sort_(elem_t *arr, bool ascend, int lo, int hi, int num_threads);
+
+#endif /* SAMPLE_SORT_H */
@@ -1,48 +1,130 @@
+#define _GNU_SOURCE
 #include "synch.h"
+#include <linux/futex.h>
+#include <sched.h>
 #include <stddef.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 //#include "common/defs.h"
 
 #define ADAPTIVE_TIMEOUT 10000
 
 #define PAUSE() asm("pause")
 
+void sync_wait(volatile unsigned int *word, unsigned int val) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+void sync_wake(volatile unsigned int *word, int count) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+unsigned int sync_spin_limit(void) {
+    static int spin_limit = -1;
+    int limit = __atomic_load_n(&spin_limit, __ATOMIC_RELAXED);
+    if (limit < 0) {
+        /* spinning only helps if the thread we wait for can run meanwhile */
+        cpu_set_t set;
+        limit = (!sched_getaffinity(0, sizeof(set), &set)
+                && CPU_COUNT(&set) < 2) ? 0 : ADAPTIVE_TIMEOUT;
+        __atomic_store_n(&spin_limit, limit, __ATOMIC_RELAXED);
+    }
+    return limit;
+}
+
 void spinlock_init(spinlock_t *lock) {
-    lock->locked = false;
+    lock->locked = 0;
 }
 
 void spinlock_lock(spinlock_t *lock) {
-    while (lock->locked || __atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE)) {
+    unsigned int c = 0;
+    if (__atomic_compare_exchange_n(&lock->locked, &c, 1, false,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    const unsigned int spins = sync_spin_limit();
+    for (unsigned int i = 0; i < spins; i++) {
         PAUSE();
+        c = 0;
+        if (!lock->locked
+                && __atomic_compare_exchange_n(&lock->locked, &c, 1, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+
+    /* mark the lock contended and sleep until it is handed back */
+    while (__atomic_exchange_n(&lock->locked, 2, __ATOMIC_ACQUIRE)) {
+        sync_wait(&lock->locked, 2);
     }
 }
 
 bool spinlock_trylock(spinlock_t *lock) {
+    unsigned int c = 0;
     return
         !lock->locked
-        && !__atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE);
+        && __atomic_compare_exchange_n(&lock->locked, &c, 1, false,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
 }
 
 void spinlock_unlock(spinlock_t *lock) {
-    __atomic_clear(&lock->locked, __ATOMIC_RELEASE);
+    if (__atomic_exchange_n(&lock->locked, 0, __ATOMIC_RELEASE) == 2) {
+        sync_wake(&lock->locked, 1);
+    }
 }
 
+/* Set in sema->value by the first waiter that sleeps. sema_up must only touch
+   the semaphore with its one atomic add, since the waiter may return and
+   release the memory right after it; the futex wake only uses the address. */
+#define SEMA_SLEEPERS 0x80000000u
+
 void sema_init(sema_t *sema, unsigned int initial_value) {
     sema->value = initial_value;
 }
 
 void sema_up(sema_t *sema) {
-    __atomic_add_fetch(&sema->value, 1, __ATOMIC_ACQUIRE);
+    if (__atomic_fetch_add(&sema->value, 1, __ATOMIC_RELEASE)
+            & SEMA_SLEEPERS) {
+        sync_wake(&sema->value, 1);
+    }
+}
+
+static bool sema_try_down(sema_t *sema, unsigned int *val) {
+    *val = __atomic_load_n(&sema->value, __ATOMIC_RELAXED);
+    while (*val & ~SEMA_SLEEPERS) {
+        if (__atomic_compare_exchange_n(&sema->value, val, *val - 1, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool sema_trydown(sema_t *sema) {
+    unsigned int val;
+    return sema_try_down(sema, &val);
 }
 
 void sema_down(sema_t *sema) {
     unsigned int val;
-    size_t spin_count = 0;
-    do {
-        spin_count++;
+    const unsigned int spins = sync_spin_limit();
+    for (unsigned int i = 0; i < spins; i++) {
+        if (sema_try_down(sema, &val)) {
+            return;
+        }
         PAUSE();
-        val = sema->value;
-    } while (!val || !__atomic_compare_exchange_n(&sema->value, &val, val - 1,
-                false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    while (!sema_try_down(sema, &val)) {
+        if (!(val & SEMA_SLEEPERS)
+                && !__atomic_compare_exchange_n(&sema->value, &val,
+                    val | SEMA_SLEEPERS, false, __ATOMIC_RELAXED,
+                    __ATOMIC_RELAXED)) {
+            continue;
+        }
+        sync_wait(&sema->value, val | SEMA_SLEEPERS);
+    }
 }
 
 struct condvar_waiter {
@@ -0,0 +1,250 @@
+#include "tag_sort.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "bucket_sort.h"
+#include "threading.h"
+
+/* blocks of this many bytes of tags are sorted and merged by one thread */
+#ifndef TAG_BLOCK_BYTES
+#define TAG_BLOCK_BYTES (256 * 1024)
+#endif
+
+/*
+ * The network is the ascending-only form of the bitonic sort over the next
+ * power of two N >= n: merging two sorted runs of s tags compares the runs
+ * back to front (a "flip"), and the half-cleaners below compare i with i + j.
+ * Every comparator puts the smaller tag first, so the virtual tags at n and
+ * beyond, all larger than any real tag, never move and their comparators are
+ * simply left out. That is a fixed set that only depends on n.
+ */
+
+enum tag_step { TAG_FLIP, TAG_HALF };
+
+struct tag_sort_ctx {
+    elem_t *arr;
+    elem_t *tmp;
+    uint64_t *tags;
+    size_t n;
+    size_t num_chunks;
+    bool ascend;
+
+    size_t block; /* tags per block, a power of two */
+    size_t num_pairs; /* N / 2 */
+    /* the global step run by global_step */
+    enum tag_step step;
+    size_t step_size;
+    /* the blocks sort up to runs of this size, then half-clean from block_j */
+    size_t block_k;
+    size_t block_j;
+};
+
+static void *tag_alloc(size_t bytes) {
+    void *p;
+    if (posix_memalign(&p, 64, bytes ? bytes : 1)) {
+        printf("Couldn't allocate %zu bytes for the tag sort\n", bytes);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static inline size_t chunk_begin(size_t n, size_t i, size_t chunks) {
+    return n * i / chunks;
+}
+
+/* compare-exchange of tags i < p, branch free */
+static inline void cmpx_tags(uint64_t *t, size_t i, size_t p) {
+    uint64_t *a = t + 2 * i, *b = t + 2 * p;
+    bool greater = (a[0] > b[0]) | ((a[0] == b[0]) & (a[1] > b[1]));
+    uint64_t m = -(uint64_t) greater;
+    uint64_t x0 = (a[0] ^ b[0]) & m, x1 = (a[1] ^ b[1]) & m;
+    a[0] ^= x0;
+    b[0] ^= x0;
+    a[1] ^= x1;
+    b[1] ^= x1;
+}
+
+#ifdef __AVX2__
+/* unsigned min/max of two tags, one per 128-bit lane */
+static inline void minmax2(__m256i *x, __m256i *y) {
+    const __m256i sign = _mm256_set1_epi64x((long long) (1ULL << 63));
+    const __m256i a = _mm256_xor_si256(*x, sign), b = _mm256_xor_si256(*y, sign);
+    const __m256i gt = _mm256_cmpgt_epi64(a, b);
+    /* first words greater, or equal and second words greater ... */
+    __m256i m = _mm256_or_si256(gt, _mm256_and_si256(_mm256_cmpeq_epi64(a, b),
+            _mm256_shuffle_epi32(gt, 0x4e)));
+    /* ... for both words of the tag */
+    m = _mm256_shuffle_epi32(m, 0x44);
+    __m256i lo = _mm256_blendv_epi8(*x, *y, m);
+    *y = _mm256_blendv_epi8(*y, *x, m);
+    *x = lo;
+}
+#endif
+
+/* comparators x in [x0, x1) of the run pair starting at base, s = run size */
+static void step_run(uint64_t *t, enum tag_step step, size_t s, size_t base,
+        size_t x0, size_t x1) {
+    size_t x = x0;
+    if (step == TAG_HALF) {
+#ifdef __AVX2__
+        for (; x + 2 <= x1; x += 2) {
+            uint64_t *pi = t + 2 * (base + x), *pp = pi + 2 * s;
+            __m256i a = _mm256_loadu_si256((const __m256i *) pi);
+            __m256i b = _mm256_loadu_si256((const __m256i *) pp);
+            minmax2(&a, &b);
+            _mm256_storeu_si256((__m256i *) pi, a);
+            _mm256_storeu_si256((__m256i *) pp, b);
+        }
+#endif
+        for (; x < x1; x++) {
+            cmpx_tags(t, base + x, base + s + x);
+        }
+    } else {
+#ifdef __AVX2__
+        for (; x + 2 <= x1; x += 2) {
+            uint64_t *pi = t + 2 * (base + x);
+            uint64_t *pp = t + 2 * (base + 2 * s - 2 - x);
+            __m256i a = _mm256_loadu_si256((const __m256i *) pi);
+            __m256i b = _mm256_permute4x64_epi64(
+                    _mm256_loadu_si256((const __m256i *) pp), 0x4e);
+            minmax2(&a, &b);
+            _mm256_storeu_si256((__m256i *) pi, a);
+            _mm256_storeu_si256((__m256i *) pp, _mm256_permute4x64_epi64(b, 0x4e));
+        }
+#endif
+        for (; x < x1; x++) {
+            cmpx_tags(t, base + x, base + 2 * s - 1 - x);
+        }
+    }
+}
+
+/* the comparators of pairs [q0, q1) of one step with runs of size s */
+static void step_pairs(const struct tag_sort_ctx *ctx, enum tag_step step,
+        size_t s, size_t q0, size_t q1) {
+    const size_t n = ctx->n;
+    for (size_t q = q0; q < q1;) {
+        const size_t base = (q & ~(s - 1)) * 2;
+        const size_t x0 = q & (s - 1);
+        size_t x1 = x0 + (q1 - q) < s ? x0 + (q1 - q) : s;
+        q += x1 - x0;
+        /* leave out the comparators with a partner at n or beyond */
+        size_t lo = x0, hi = x1;
+        if (step == TAG_HALF) {
+            if (base + s >= n) continue;
+            if (hi > n - base - s) hi = n - base - s;
+        } else {
+            if (base + 2 * s - 1 >= n && lo < base + 2 * s - n) lo = base + 2 * s - n;
+        }
+        if (lo < hi) step_run(ctx->tags, step, s, base, lo, hi);
+    }
+}
+
+static void global_step(void *arg, size_t chunk) {
+    const struct tag_sort_ctx *ctx = arg;
+    step_pairs(ctx, ctx->step, ctx->step_size,
+            chunk_begin(ctx->num_pairs, chunk, ctx->num_chunks),
+            chunk_begin(ctx->num_pairs, chunk + 1, ctx->num_chunks));
+}
+
+/* in block b: every merge of runs up to block_k, then the half-cleaners
+   from block_j down */
+static void block_steps(void *arg, size_t b) {
+    const struct tag_sort_ctx *ctx = arg;
+    const size_t q0 = b * ctx->block / 2, q1 = q0 + ctx->block / 2;
+    for (size_t k = 2; k <= ctx->block_k; k *= 2) {
+        step_pairs(ctx, TAG_FLIP, k / 2, q0, q1);
+        for (size_t j = k / 4; j >= 1; j /= 2) {
+            step_pairs(ctx, TAG_HALF, j, q0, q1);
+        }
+    }
+    for (size_t j = ctx->block_j; j >= 1; j /= 2) {
+        step_pairs(ctx, TAG_HALF, j, q0, q1);
+    }
+}
+
+static void sort_tags(struct tag_sort_ctx *ctx) {
+    size_t N = 1;
+    while (N < ctx->n) N *= 2;
+    size_t block = TAG_BLOCK_BYTES / (2 * sizeof(uint64_t));
+    if (block > N) block = N;
+    const size_t num_blocks = (ctx->n + block - 1) / block;
+    ctx->block = block;
+    ctx->num_pairs = N / 2;
+
+    ctx->block_k = block;
+    ctx->block_j = 0;
+    thread_run_iter(block_steps, ctx, num_blocks);
+
+    ctx->block_k = 1;
+    for (size_t k = 2 * block; k <= N; k *= 2) {
+        ctx->step = TAG_FLIP;
+        ctx->step_size = k / 2;
+        thread_run_iter(global_step, ctx, ctx->num_chunks);
+        ctx->step = TAG_HALF;
+        for (ctx->step_size = k / 4; ctx->step_size >= block; ctx->step_size /= 2) {
+            thread_run_iter(global_step, ctx, ctx->num_chunks);
+        }
+        ctx->block_j = block / 2;
+        thread_run_iter(block_steps, ctx, num_blocks);
+    }
+}
+
+/* equal keys are ordered by the unique idx, never by the shuffled position,
+   so the gather stays a uniformly random permutation; descending sorts
+   complement the keys, so the network always ascends */
+static void make_tags(void *arg, size_t chunk) {
+    struct tag_sort_ctx *ctx = arg;
+    const size_t first = chunk_begin(ctx->n, chunk, ctx->num_chunks);
+    const size_t last = chunk_begin(ctx->n, chunk + 1, ctx->num_chunks);
+    const uint64_t flip = ctx->ascend ? 0 : ~(uint64_t) 0;
+    for (size_t i = first; i < last; i++) {
+        const elem_t *row = &ctx->arr[i];
+        ctx->tags[2 * i] = ((uint64_t) row->key << 32 | row->idx) ^ flip;
+        ctx->tags[2 * i + 1] = i;
+    }
+}
+
+static void gather_rows(void *arg, size_t chunk) {
+    struct tag_sort_ctx *ctx = arg;
+    const size_t first = chunk_begin(ctx->n, chunk, ctx->num_chunks);
+    const size_t last = chunk_begin(ctx->n, chunk + 1, ctx->num_chunks);
+    for (size_t i = first; i < last; i++) {
+        ctx->tmp[i] = ctx->arr[ctx->tags[2 * i + 1]];
+    }
+}
+
+static void copy_back(void *arg, size_t chunk) {
+    struct tag_sort_ctx *ctx = arg;
+    const size_t first = chunk_begin(ctx->n, chunk, ctx->num_chunks);
+    const size_t last = chunk_begin(ctx->n, chunk + 1, ctx->num_chunks);
+    memcpy(ctx->arr + first, ctx->tmp + first, (last - first) * sizeof(*ctx->arr));
+}
+
+void tag_sort_(elem_t *arr, bool ascend, int lo, int hi, int num_threads,
+        bool D2enable) {
+    if (hi - lo < 2) return;
+
+    struct tag_sort_ctx ctx = {
+        .arr = arr + lo,
+        .n = (size_t) (hi - lo),
+        .num_chunks = num_threads > 1 ? (size_t) num_threads : 1,
+        .ascend = ascend,
+    };
+    (void) D2enable; /* the idx breaks every tie anyway */
+
+    bucket_shuffle_(arr, lo, hi, num_threads);
+
+    ctx.tags = tag_alloc(ctx.n * 2 * sizeof(*ctx.tags));
+    thread_run_iter(make_tags, &ctx, ctx.num_chunks);
+    sort_tags(&ctx);
+
+    ctx.tmp = tag_alloc(ctx.n * sizeof(*ctx.tmp));
+    thread_run_iter(gather_rows, &ctx, ctx.num_chunks);
+    thread_run_iter(copy_back, &ctx, ctx.num_chunks);
+    free(ctx.tmp);
+    free(ctx.tags);
+}
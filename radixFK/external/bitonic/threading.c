@@ -1,32 +1,141 @@
 #include "threading.h"
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include "synch.h"
+#include "worker_pool.h"
 //#include "common/util.h"
 
-struct task {
-    struct thread_work *work;
-    union {
-        struct {} single;
-        struct {
-            size_t i;
-        } iter;
-    };
-};
+/*
+ * Every thread taking part in the sort owns a Chase-Lev deque (Le et al.,
+ * "Correct and Efficient Work-Stealing for Weak Memory Models", PPoPP'13).
+ * The owner pushes and pops at the bottom without locks; idle threads steal
+ * from the top of the others' deques. A full deque makes thread_work_push
+ * run the work inline.
+ */
+#define DEQUE_CAPACITY 4096
+#define DEQUE_MASK (DEQUE_CAPACITY - 1)
+
+struct deque {
+    long top;
+    char pad[64 - sizeof(long)];
+    long bottom;
+    struct thread_work *buf[DEQUE_CAPACITY];
+} __attribute__((aligned(64)));
 
 size_t total_num_threads;
 size_t num_threads_working;
 
-static spinlock_t thread_work_lock;
-static struct thread_work *volatile work_head;
-static struct thread_work *volatile work_tail;
+static struct deque *deques;
+static size_t num_deques;
+static size_t next_deque;
+static unsigned int deque_generation;
 static volatile bool work_done;
 
+/* deque of the calling thread, valid while my_generation is current */
+static _Thread_local size_t my_deque;
+static _Thread_local unsigned int my_generation;
+
+/* Bumped whenever work is pushed or the workers are released; idle workers
+   sleep on it once stealing has come up empty for a while. */
+static volatile unsigned int work_seq;
+static unsigned int work_sleepers;
+
+static void work_wake(int count) {
+    __atomic_add_fetch(&work_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&work_sleepers, __ATOMIC_SEQ_CST)) {
+        sync_wake(&work_seq, count);
+    }
+}
+
+/* Returns the calling thread's deque, registering it on first use; NULL if
+   more threads took part than total_num_threads. */
+static struct deque *own_deque(void) {
+    const unsigned int gen =
+        __atomic_load_n(&deque_generation, __ATOMIC_ACQUIRE);
+    if (my_generation != gen) {
+        my_deque = __atomic_fetch_add(&next_deque, 1, __ATOMIC_RELAXED);
+        my_generation = gen;
+    }
+    return my_deque < num_deques ? &deques[my_deque] : NULL;
+}
+
+static bool deque_push(struct deque *q, struct thread_work *work) {
+    const long b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+    const long t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+    if (b - t >= DEQUE_CAPACITY) {
+        return false;
+    }
+    __atomic_store_n(&q->buf[b & DEQUE_MASK], work, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static struct thread_work *deque_pop(struct deque *q) {
+    const long b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&q->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    struct thread_work *work =
+        __atomic_load_n(&q->buf[b & DEQUE_MASK], __ATOMIC_RELAXED);
+    if (t == b) {
+        /* last entry: race the thieves for it */
+        if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, false,
+                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            work = NULL;
+        }
+        __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return work;
+}
+
+static struct thread_work *deque_steal(struct deque *q) {
+    long t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    const long b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return NULL;
+    }
+    struct thread_work *work =
+        __atomic_load_n(&q->buf[t & DEQUE_MASK], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return work;
+}
+
+static bool work_available(void) {
+    for (size_t i = 0; i < num_deques; i++) {
+        if (__atomic_load_n(&deques[i].top, __ATOMIC_SEQ_CST)
+                < __atomic_load_n(&deques[i].bottom, __ATOMIC_SEQ_CST)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 // Add initialization function
 void thread_system_init(void) {
-    spinlock_init(&thread_work_lock);
-    work_head = NULL;
-    work_tail = NULL;
+    num_deques = total_num_threads ? total_num_threads : 1;
+    if (posix_memalign((void **) &deques, 64,
+                num_deques * sizeof(*deques))) {
+        printf("Couldn't allocate the work deques\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < num_deques; i++) {
+        deques[i].top = 0;
+        deques[i].bottom = 0;
+    }
+    next_deque = 0;
+    __atomic_add_fetch(&deque_generation, 1, __ATOMIC_RELEASE);
     work_done = false;
     num_threads_working = 0;
 }
@@ -34,11 +143,14 @@ void thread_system_init(void) {
 // Add cleanup function
 void thread_system_cleanup(void) {
     work_done = true;
-    work_head = NULL;
-    work_tail = NULL;
+    free(deques);
+    deques = NULL;
+    num_deques = 0;
     num_threads_working = 0;
 }
 
+static void do_work(struct thread_work *work);
+
 void thread_work_push(struct thread_work *work) {
     sema_init(&work->done, 0);
 
@@ -56,86 +168,101 @@ void thread_work_push(struct thread_work *work) {
             break;
     }
 
-    spinlock_lock(&thread_work_lock);
-    work->next = NULL;
-    if (!work_tail) {
-        /* Empty list. Set head and tail. */
-        work_head = work;
-        work_tail = work;
-    } else {
-        /* List has values. */
-        work_tail->next = work;
-        work_tail = work;
-    }
-    spinlock_unlock(&thread_work_lock);
-}
-
-void thread_wait(struct thread_work *work) {
-    sema_down(&work->done);
-}
-
-static bool get_task(struct task *task) {
-    task->work = NULL;
-    if (work_head) {
-        spinlock_lock(&thread_work_lock);
-        if (work_head) {
-            task->work = work_head;
-
-            bool pop_work = false;
-            switch (task->work->type) {
-                case THREAD_WORK_SINGLE:
-                    pop_work = true;
-                    break;
-                case THREAD_WORK_ITER:
-                    task->iter.i = task->work->iter.curr;
-                    task->work->iter.curr++;
-                    if (task->work->iter.curr
-                            >= task->work->iter.count) {
-                        pop_work = true;
-                    }
-                    break;
-            }
-
-            if (pop_work) {
-                if (!work_head->next) {
-                    work_tail = NULL;
-                }
-                work_head = work_head->next;
-            }
+    /* an iterated item gets one entry per index; each entry claims the next
+       index, so no entry outlives the item */
+    const size_t entries =
+        work->type == THREAD_WORK_ITER ? work->iter.count : 1;
+    struct deque *q = own_deque();
+    for (size_t k = 0; k < entries; k++) {
+        if (!q || !deque_push(q, work)) {
+            do_work(work);
         }
-        spinlock_unlock(&thread_work_lock);
     }
-    return task->work;
+    work_wake(entries < INT_MAX ? (int) entries : INT_MAX);
 }
 
-static void do_task(struct task *task) {
-    switch (task->work->type) {
+static void do_work(struct thread_work *work) {
+    switch (work->type) {
         case THREAD_WORK_SINGLE:
-            task->work->single.func(task->work->single.arg);
-            sema_up(&task->work->done);
+            work->single.func(work->single.arg);
+            sema_up(&work->done);
             break;
-        case THREAD_WORK_ITER:
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
-            task->work->iter.func(task->work->iter.arg,
-                    task->iter.i);
-#pragma GCC diagnostic pop
-            if (!__atomic_sub_fetch(&task->work->iter.num_remaining, 1,
+        case THREAD_WORK_ITER: {
+            const size_t i =
+                __atomic_fetch_add(&work->iter.curr, 1, __ATOMIC_RELAXED);
+            work->iter.func(work->iter.arg, i);
+            if (!__atomic_sub_fetch(&work->iter.num_remaining, 1,
                         __ATOMIC_RELEASE)) {
-                sema_up(&task->work->done);
+                sema_up(&work->done);
             }
             break;
+        }
+    }
+}
+
+/* Takes work from the caller's own deque, else steals it from another. */
+static struct thread_work *find_work(void) {
+    struct deque *q = own_deque();
+    struct thread_work *work;
+    if (q && (work = deque_pop(q))) {
+        return work;
+    }
+    const size_t self = q ? (size_t) (q - deques) : 0;
+    for (size_t k = 1; k <= num_deques; k++) {
+        if ((work = deque_steal(&deques[(self + k) % num_deques]))) {
+            return work;
+        }
+    }
+    return NULL;
+}
+
+void thread_wait(struct thread_work *work) {
+    /* help with other work, own deque first, until the item is done; park
+       once there is nothing left to take */
+    while (!sema_trydown(&work->done)) {
+        struct thread_work *other = find_work();
+        if (!other) {
+            sema_down(&work->done);
+            return;
+        }
+        do_work(other);
     }
 }
 
+void thread_run_iter(void (*fn)(void *arg, size_t i), void *arg, size_t count) {
+    struct thread_work work;
+    work.type = THREAD_WORK_ITER;
+    work.iter.func = fn;
+    work.iter.arg = arg;
+    work.iter.count = count;
+    thread_work_push(&work);
+    thread_wait(&work);
+}
+
 void thread_start_work(void) {
     __atomic_add_fetch(&num_threads_working, 1, __ATOMIC_ACQUIRE);
 
+    const unsigned int spins = sync_spin_limit();
+    unsigned int idle = 0;
     while (!work_done) {
-        struct task task;
-        if (get_task(&task)) {
-            do_task(&task);
+        struct thread_work *work = find_work();
+        if (work) {
+            do_work(work);
+            idle = 0;
+            continue;
+        }
+        if (idle++ < spins) {
+            continue;
+        }
+
+        const unsigned int seq = __atomic_load_n(&work_seq, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&work_sleepers, 1, __ATOMIC_SEQ_CST);
+        if (!work_available()
+                && !__atomic_load_n(&work_done, __ATOMIC_SEQ_CST)) {
+            sync_wait(&work_seq, seq);
         }
+        __atomic_sub_fetch(&work_sleepers, 1, __ATOMIC_SEQ_CST);
+        idle = 0;
     }
 
     __atomic_sub_fetch(&num_threads_working, 1, __ATOMIC_RELEASE);
@@ -144,9 +271,9 @@ void thread_start_work(void) {
 void thread_work_until_empty(void) {
     __atomic_add_fetch(&num_threads_working, 1, __ATOMIC_ACQUIRE);
 
-    struct task task;
-    while (get_task(&task)) {
-        do_task(&task);
+    struct thread_work *work;
+    while ((work = find_work())) {
+        do_work(work);
     }
 
     __atomic_sub_fetch(&num_threads_working, 1, __ATOMIC_RELEASE);
@@ -170,8 +297,43 @@ void thread_wait_for_all(void) {
 
 void thread_release_all(void) {
     work_done = true;
+    work_wake(INT_MAX);
 }
 
 void thread_unrelease_all(void) {
     work_done = false;
 }
+
+struct pool_run {
+    void (*main_fn)(void *arg, size_t num_threads);
+    void *arg;
+    size_t num_threads;
+};
+
+static void pool_lane(void *voidargs, int i) {
+    struct pool_run *run = voidargs;
+    if (i == 0) {
+        run->main_fn(run->arg, run->num_threads);
+        thread_release_all();
+    } else {
+        thread_start_work();
+    }
+}
+
+void thread_run_on_pool(void (*main_fn)(void *arg, size_t num_threads),
+        void *arg, size_t num_threads) {
+    size_t team = worker_pool_team_size();
+    struct pool_run run = {
+        .main_fn = main_fn,
+        .arg = arg,
+        .num_threads = num_threads < team ? num_threads : team,
+    };
+    if (!run.num_threads) {
+        run.num_threads = 1;
+    }
+
+    total_num_threads = run.num_threads;
+    thread_system_init();
+    worker_pool_run(run.num_threads, pool_lane, &run);
+    thread_system_cleanup();
+}
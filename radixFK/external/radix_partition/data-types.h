@@ -47,6 +47,29 @@ struct table_t {
     uint64_t num_tuples;
 };
 
+/*
+ * Tag of a row in the counts join (RHO), what its partitioning passes and
+ * join tasks move instead of the 32-byte row. The key is left out: hashKey is
+ * triple32 of the key, a bijection, so equal hashKeys mean equal keys. The
+ * payload the join reads or writes rides in the tag and is written back to
+ * the row by idx once the join is done.
+ */
+struct tag_t {
+    uint32_t hashKey;
+    uint32_t idx;   /* row of the tag, with TAG_DEAD on a dummy foreign row */
+    type_value pay; /* paySelf of a primary row, payPrimary of a foreign one */
+} __attribute__((aligned(16)));
+
+/* rows are fewer than 2^31, so the top bit of idx marks a row with cntSelf 0
+   on the foreign key side, which never matches */
+#define TAG_DEAD 0x80000000u
+#define TAG_IDX(T) ((T).idx & ~TAG_DEAD)
+
+struct tag_table_t {
+    struct tag_t* tags;
+    uint64_t num_tags;
+};
+
 struct output_list_t {
     type_key key;
     type_value Rpayload;
@@ -81,6 +104,7 @@ struct result_t {
 struct join_result_t {
     uint64_t matches;
     uint64_t checksum;
+    uint64_t sum;
     uint64_t time_usec;
     uint64_t part_usec;
     uint64_t join_usec;
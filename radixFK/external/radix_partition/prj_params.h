@@ -12,27 +12,31 @@
 #define PRJ_PARAMS_H
 
 #include "data-types.h"
+#include <stddef.h>
 
-/** number of total radix bits used for partitioning. */
+/** default number of total radix bits used for partitioning, see
+    radix_params */
 #ifndef NUM_RADIX_BITS
 #define NUM_RADIX_BITS 8
 #endif
 
-/** number of passes in multipass partitioning, currently fixed at 2. */
+/** default number of passes in multipass partitioning */
 #ifndef NUM_PASSES
 #define NUM_PASSES 2
 #endif
 
+/** most passes the partitioning supports */
+#define RADIX_MAX_PASSES 4
+
 /** number of probe items for prefetching: must be a power of 2 */
 #ifndef PROBE_BUFFER_SIZE
 #define PROBE_BUFFER_SIZE 4
 #endif
 
-/** 
- * Whether to use software write-combining optimized partitioning, 
- * see --enable-optimized-part config option 
+/**
+ * Software write-combining partitioning is selected at run time, see
+ * radix_scatter.h
  */
-/* #define USE_SWWC_OPTIMIZED_PART 1 */
 
 /** @defgroup SystemParameters System Parameters
  *  Various system specific parameters such as cache/cache-line sizes,
@@ -40,7 +44,9 @@
  *  @{
  */
 
-/** L1 cache parameters. \note Change as needed for different machines */
+/** Cache parameters. \note radix_tuner.h detects the cache geometry at run
+    time and only falls back to these; CACHE_LINE_SIZE also sets the
+    alignment and padding of the partitions */
 #ifndef CACHE_LINE_SIZE
 #define CACHE_LINE_SIZE 64
 #endif
@@ -55,6 +61,11 @@
 #define L1_ASSOCIATIVITY 12 
 #endif
 
+/** L2 cache size */
+#ifndef L2_CACHE_SIZE
+#define L2_CACHE_SIZE 1048576
+#endif
+
 /** number of tuples fitting into L1 */
 #define L1_CACHE_TUPLES (L1_CACHE_SIZE/sizeof(struct row_t))
 
@@ -69,29 +80,57 @@
 
 
 /** \internal some padding space is allocated for relations in order to
- *  avoid L1 conflict misses and PADDING_TUPLES is placed between 
- *  partitions in pass-1 of partitioning and SMALL_PADDING_TUPLES is placed
- *  between partitions in pass-2 of partitioning. 3 is a magic number. 
+ *  avoid L1 conflict misses: SMALL_PADDING_TUPLES is placed between
+ *  partitions in the last pass of partitioning and every earlier pass leaves
+ *  room for the paddings of the passes after it, see radix_pass_padding.
+ *  3 is a magic number.
  */
 
-/* num-parts at pass-1 */
-#define FANOUT_PASS1 (1 << (NUM_RADIX_BITS/NUM_PASSES))
-/* num-parts at pass-1 */
-#define FANOUT_PASS2 (1 << (NUM_RADIX_BITS-(NUM_RADIX_BITS/NUM_PASSES)))
-
-/** 
- * Put an odd number of cache lines between partitions in pass-2:
+/**
+ * Put an odd number of cache lines between partitions in the last pass:
  * Here we put 3 cache lines.
  */
 #define SMALL_PADDING_TUPLES (3 * CACHE_LINE_SIZE/sizeof(struct row_t))
-#define PADDING_TUPLES (SMALL_PADDING_TUPLES*(FANOUT_PASS2+1))
+
+/** \endinternal */
+
+/** radix bits and passes of one join, chosen at run time */
+struct radix_params {
+  int bits;   /* total radix bits, 2^bits partitions */
+  int passes; /* partitioning passes, 1 .. RADIX_MAX_PASSES */
+};
+
+/* radix bits of pass k, 0 .. passes - 1; when the passes do not divide the
+   bits evenly the last ones take one more */
+static inline int radix_pass_bits(const struct radix_params *p, int k) {
+  return p->bits / p->passes + (k >= p->passes - p->bits % p->passes);
+}
+
+/* lowest hash bit pass k partitions on: the bits of the passes before it */
+static inline int radix_pass_shift(const struct radix_params *p, int k) {
+  int shift = 0, j;
+  for (j = 0; j < k; j++)
+    shift += radix_pass_bits(p, j);
+  return shift;
+}
+
+/* padding between the partitions of pass k: SMALL_PADDING_TUPLES plus room for
+   the paddings every later pass puts between the sub-partitions */
+static inline uint32_t radix_pass_padding(const struct radix_params *p,
+                                          int k) {
+  uint32_t padding = SMALL_PADDING_TUPLES;
+  int j;
+  for (j = p->passes - 1; j > k; j--)
+    padding = SMALL_PADDING_TUPLES + (1u << radix_pass_bits(p, j)) * padding;
+  return padding;
+}
 
 /** @warning This padding must be allocated at the end of relation */
-#ifndef RELATION_PADDING
-#define RELATION_PADDING (PADDING_TUPLES*FANOUT_PASS1*sizeof(struct row_t))
-#endif
+static inline size_t radix_relation_padding(const struct radix_params *p) {
+  return (size_t)radix_pass_padding(p, 0) * (1u << radix_pass_bits(p, 0)) *
+         sizeof(struct row_t);
+}
 
-/** \endinternal */
 
 #ifndef CORES
 #define CORES 24
@@ -2,15 +2,21 @@
 #define _RADIX_JOIN_COUNTS_H_
 
 #include "data-types.h"
+#include "prj_params.h"
+#include "scratch.h"
 #include <stdbool.h>
 #include <stdlib.h>
 
-typedef int64_t (*JoinFunction)(const struct table_t *const,
-                                const struct table_t *const,
-                                struct table_t *const, output_list_t **output,
-                                bool isSPrimary, int bins);
+/* joins the tags of a partition pair, see struct tag_t */
+typedef int64_t (*JoinFunction)(const struct tag_table_t *const,
+                                const struct tag_table_t *const,
+                                struct tag_table_t *const,
+                                output_list_t **output,
+                                bool isSPrimary, int bins,
+                                struct scratch *scratch, int radix_bits);
 
 result_t *RHO(struct table_t *relR, struct table_t *relS, int nthreads,
-              bool isSPrimary, int bins);
+              bool isSPrimary, int bins,
+              const struct radix_params *params);
 
 #endif //_RADIX_JOIN_COUNTS_H_
@@ -1,15 +1,19 @@
 #include "radix_join_idx.h"
-#include "barrier.h"
+#include "bin_layout.h"
 #include "data-types.h"
+#include "join_arena.h"
 #include "malloc.h"
+#include "numa_shuffle.h"
 #include "prj_params.h"
+#include "radix_scatter.h"
 #include "task_queue.h"
 #include "util.h"
+#include "worker_pool.h"
 #include <immintrin.h>
 #include <math.h>
-#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define HASH_BIT_MODULO(K, MASK, NBITS) (((K) & MASK) >> NBITS)
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
@@ -40,14 +44,17 @@ struct arg_t_radix {
   uint64_t totalR;
   uint64_t totalS;
 
-  task_queue_t *join_queue;
-  task_queue_t *part_queue;
+  /* queues[k]: partition pairs after pass k + 1, the last ones are joined */
+  task_queue_t **queues;
 
-  pthread_barrier_t *barrier;
+  worker_barrier_t *barrier;
   JoinFunctionIdx join_function;
   int64_t result;
   int32_t my_tid;
+  struct scratch *scratch; /* arena of the thread, see scratch.h */
   int nthreads;
+  struct radix_params params;
+  int32_t *nodes; /* NUMA node of every thread */
 
   /* stats about the thread */
   int32_t parts_processed;
@@ -84,46 +91,48 @@ int64_t bucket_chaining_join_idx(const struct table_t *const R,
                                  const struct table_t *const S,
                                  struct table_t *const tmpR,
                                  output_list_t **output,
-                                 struct table_t *expanded, int bins) {
+                                 struct table_t *expanded, int bins,
+                                 struct scratch *scratch,
+                                 int radix_bits) {
   (void)(tmpR);
   (void)(output);
 
-  int *next, *bucket;
   const uint64_t numR = R->num_tuples;
   const uint64_t numS = S->num_tuples;
-  const uint32_t MASK = (bins - 1) << (NUM_RADIX_BITS);
-  next = (int *)malloc(sizeof(int) * numR);
-  bucket = (int *)calloc(bins, sizeof(int));
+  const uint32_t MASK = (bins - 1) << radix_bits;
+  struct bin_layout bl;
+  struct row_t *out;
 
+  /* the result row of every slot, read once before and written once after
+     the probe; the idx of the rows of R are distinct */
   struct row_t *Rtuples = R->tuples;
-  for (uint32_t i = 0; i < numR;) {
-    uint32_t idx = HASH_BIT_MODULO(R->tuples[i].hashKey, MASK, NUM_RADIX_BITS);
-    next[i] = bucket[idx];
-    bucket[idx] = ++i; /* we start pos's from 1 instead of 0 */
-  }
+  const uint32_t maxSlots = bin_layout_max_slots(numR, bins);
+  scratch_reset(scratch, bin_layout_room(numR, bins) +
+                             SCRATCH_ROOM(maxSlots * sizeof(struct row_t)));
+  bin_layout_build(&bl, scratch, Rtuples, numR, MASK, radix_bits, bins, true);
+  out = (struct row_t *)scratch_alloc(scratch, bl.slots * sizeof(struct row_t));
+  memset(out, 0, bl.slots * sizeof(struct row_t));
+  for (uint32_t i = 0; i < numR; i++)
+    out[bl.slot[i]] = expanded->tuples[Rtuples[i].idx];
 
   struct row_t *Stuples = S->tuples;
   for (uint32_t i = 0; i < numS; i++) {
-    uint32_t idx = HASH_BIT_MODULO(Stuples[i].hashKey, MASK, NUM_RADIX_BITS);
-    uint32_t outPos;
-    int match;
-    for (int hit = bucket[idx]; hit > 0; hit = next[hit - 1]) {
-      outPos = Rtuples[hit - 1].idx;
-      match = (Stuples[i].idx == outPos) & (Stuples[i].payPrimary[0] != 0);
-      __m256i vSrc = _mm256_loadu_si256((const __m256i *)(&Stuples[i]));
-      __m256i vDst = _mm256_loadu_si256(
-          (const __m256i *)(&expanded->tuples[Rtuples[hit - 1].idx]));
-      __m256i m = _mm256_set1_epi64x(-(uint64_t)match); // 256-bit broadcast
-      __m256i res = _mm256_or_si256(_mm256_and_si256(vSrc, m),
-                                    _mm256_andnot_si256(m, vDst));
-      _mm256_storeu_si256((__m256i *)(&expanded->tuples[Rtuples[hit - 1].idx]),
-                          res);
+    uint32_t idx = HASH_BIT_MODULO(Stuples[i].hashKey, MASK, radix_bits);
+    const __m256i outPos = _mm256_set1_epi32((int)Stuples[i].idx);
+    const __m256i live = _mm256_set1_epi32(-(Stuples[i].payPrimary[0] != 0));
+    __m256i vSrc = _mm256_loadu_si256((const __m256i *)(&Stuples[i]));
+    for (uint32_t s = bl.start[idx]; s < bl.start[idx + 1]; s += BIN_LANES) {
+      const __m256i match = bin_match(&bl, s, outPos, live);
+      for (int j = 0; j < BIN_LANES; j++) {
+        __m256i *dst = (__m256i *)(&out[s + j]);
+        _mm256_store_si256(dst, _mm256_blendv_epi8(_mm256_load_si256(dst), vSrc,
+                                                   bin_lane(match, j)));
+      }
     }
   }
 
-  /* clean up temp */
-  free(bucket);
-  free(next);
+  for (uint32_t i = 0; i < numR; i++)
+    expanded->tuples[Rtuples[i].idx] = out[bl.slot[i]];
 
   return 0;
 }
@@ -142,10 +151,13 @@ int64_t bucket_chaining_join_idx(const struct table_t *const R,
  * @param hist [out] number of tuples in each partition
  * @param R cluster bits
  * @param D radix bits per pass
+ * @param ids [tmp] room for the partition id of every input tuple
+ * @param padding tuples between clusters
  * @returns tuples per partition.
  */
 static void radix_cluster(struct table_t *outRel, struct table_t *inRel,
-                          int64_t *hist, int R, int D) {
+                          uint32_t *hist, uint16_t *ids, int R, int D,
+                          uint32_t padding) {
   uint64_t i;
   uint32_t M = ((1 << D) - 1) << R;
   uint32_t offset;
@@ -157,75 +169,78 @@ static void radix_cluster(struct table_t *outRel, struct table_t *inRel,
   uint32_t dst[fanOut];
 
   /* count tuples per cluster */
-  for (i = 0; i < inRel->num_tuples; i++) {
-    uint64_t idx = HASH_BIT_MODULO(inRel->tuples[i].hashKey, M, R);
-    hist[idx]++;
-  }
+  radix_histogram(inRel->tuples, inRel->num_tuples, M, R, ids, hist, fanOut);
   offset = 0;
   /* determine the start and end of each cluster depending on the counts. */
   for (i = 0; i < fanOut; i++) {
     /* dst[i]      = outRel->tuples + offset; */
     /* determine the beginning of each partitioning by adding some
        padding to avoid L1 conflict misses during scatter. */
-    dst[i] = (uint32_t)(offset + i * SMALL_PADDING_TUPLES);
+    dst[i] = (uint32_t)(offset + i * padding);
     offset += hist[i];
   }
 
   /* copy tuples to their corresponding clusters at appropriate offsets */
-  for (i = 0; i < inRel->num_tuples; i++) {
-    uint32_t idx = HASH_BIT_MODULO(inRel->tuples[i].hashKey, M, R);
-    outRel->tuples[dst[idx]] = inRel->tuples[i];
-    ++dst[idx];
-  }
+  radix_scatter(outRel->tuples, inRel->tuples, ids, inRel->num_tuples, dst,
+                fanOut);
 }
 
 /**
  * This function implements the radix clustering of a given input
  * relations. The relations to be clustered are defined in task_t and after
- * clustering, each partition pair is added to the join_queue to be joined.
+ * clustering, each partition pair is added to out_queue, to be partitioned by
+ * the next pass or joined.
  *
  * @param task description of the relation to be partitioned
- * @param join_queue task queue to add join tasks after clustering
+ * @param out_queue task queue to add the partition pairs to
+ * @param padding tuples between the partitions, see radix_pass_padding
+ * @param scratch arena of the calling thread
  */
-static void serial_radix_partition(task_t *const task, task_queue_t *join_queue,
-                                   const int R, const int D) {
+static void serial_radix_partition(task_t *const task, task_queue_t *out_queue,
+                                   const int R, const int D,
+                                   const uint32_t padding,
+                                   struct scratch *scratch) {
   int i;
   uint64_t offsetR = 0, offsetS = 0;
-  const int fanOut = 1 << D; /*(NUM_RADIX_BITS / NUM_PASSES);*/
-  int64_t *outputR, *outputS;
-
-  outputR = (int64_t *)calloc(fanOut + 1, sizeof(int64_t));
-  outputS = (int64_t *)calloc(fanOut + 1, sizeof(int64_t));
+  const int fanOut = 1 << D;
+  const uint64_t numMax = MAX(task->relR.num_tuples, task->relS.num_tuples);
+  uint32_t *outputR, *outputS;
+  uint16_t *ids;
+
+  scratch_reset(scratch, 2 * SCRATCH_ROOM((fanOut + 1) * sizeof(uint32_t)) +
+                             SCRATCH_ROOM(numMax * sizeof(uint16_t)));
+  outputR = (uint32_t *)scratch_alloc(scratch, (fanOut + 1) * sizeof(uint32_t));
+  outputS = (uint32_t *)scratch_alloc(scratch, (fanOut + 1) * sizeof(uint32_t));
+  ids = (uint16_t *)scratch_alloc(scratch, numMax * sizeof(uint16_t));
+  memset(outputR, 0, (fanOut + 1) * sizeof(uint32_t));
+  memset(outputS, 0, (fanOut + 1) * sizeof(uint32_t));
   /* TODO: measure the effect of memset() */
   /* memset(outputR, 0, fanOut * sizeof(int32_t)); */
-  radix_cluster(&task->tmpR, &task->relR, outputR, R, D);
+  radix_cluster(&task->tmpR, &task->relR, outputR, ids, R, D, padding);
 
   /* memset(outputS, 0, fanOut * sizeof(int32_t)); */
-  radix_cluster(&task->tmpS, &task->relS, outputS, R, D);
+  radix_cluster(&task->tmpS, &task->relS, outputS, ids, R, D, padding);
 
   /* task_t t; */
   for (i = 0; i < fanOut; i++) {
     if (outputR[i] > 0 && outputS[i] > 0) {
-      task_t *t = task_queue_get_slot_atomic(join_queue);
+      task_t *t = task_queue_get_slot_atomic(out_queue);
       t->relR.num_tuples = outputR[i];
-      t->relR.tuples = task->tmpR.tuples + offsetR + i * SMALL_PADDING_TUPLES;
-      t->tmpR.tuples = task->relR.tuples + offsetR + i * SMALL_PADDING_TUPLES;
+      t->relR.tuples = task->tmpR.tuples + offsetR + i * padding;
+      t->tmpR.tuples = task->relR.tuples + offsetR + i * padding;
       offsetR += outputR[i];
 
       t->relS.num_tuples = outputS[i];
-      t->relS.tuples = task->tmpS.tuples + offsetS + i * SMALL_PADDING_TUPLES;
-      t->tmpS.tuples = task->relS.tuples + offsetS + i * SMALL_PADDING_TUPLES;
+      t->relS.tuples = task->tmpS.tuples + offsetS + i * padding;
+      t->tmpS.tuples = task->relS.tuples + offsetS + i * padding;
       offsetS += outputS[i];
 
-      /* task_queue_copy_atomic(join_queue, &t); */
-      task_queue_add_atomic(join_queue, t);
+      task_queue_add_atomic(out_queue, t);
     } else {
       offsetR += outputR[i];
       offsetS += outputS[i];
     }
   }
-  free(outputR);
-  free(outputS);
 }
 
 /**
@@ -259,18 +274,16 @@ static void parallel_radix_partition(part_t *const part) {
 
   int32_t sum = 0;
   uint32_t i, j;
-  int rv = 0;
 
-  int32_t dst[fanOut + 1];
+  uint32_t dst[fanOut + 1];
 
   /* compute local histogram for the assigned region of rel */
   /* compute histogram */
   int32_t *my_hist = hist[my_tid];
 
-  for (i = 0; i < size; i++) {
-    uint32_t idx = HASH_BIT_MODULO(rel[i].hashKey, MASK, R);
-    my_hist[idx]++;
-  }
+  uint16_t *ids = (uint16_t *)malloc(size * sizeof(uint16_t));
+  malloc_check(ids);
+  radix_histogram(rel, size, MASK, R, ids, (uint32_t *)my_hist, fanOut);
 
   /* compute local prefix sum on hist */
   for (i = 0; i < fanOut; i++) {
@@ -279,7 +292,7 @@ static void parallel_radix_partition(part_t *const part) {
   }
 
   /* wait at a barrier until each thread complete histograms */
-  barrier_arrive(part->thrargs->barrier, rv);
+  worker_barrier_wait(part->thrargs->barrier);
 
   /* determine the start and end of each cluster */
   for (i = 0; i < my_tid; i++) {
@@ -299,12 +312,39 @@ static void parallel_radix_partition(part_t *const part) {
 
   struct row_t *tmp = part->tmp;
 
-  /* Copy tuples to their corresponding clusters */
-  for (i = 0; i < size; i++) {
-    uint32_t idx = HASH_BIT_MODULO(rel[i].hashKey, MASK, R);
-    tmp[dst[idx]] = rel[i];
-    ++dst[idx];
+  const int num_nodes = worker_pool_num_nodes();
+  if (num_nodes > 1) {
+    /* NUMA-aware shuffling: scatter to the partitions of one node at a time,
+       in the order of the shuffling strategy (see numa_shuffle.h) */
+    const size_t bytes =
+        part->total_tuples * sizeof(struct row_t) +
+        radix_relation_padding(&part->thrargs->params);
+    const int32_t *nodes = part->thrargs->nodes;
+    int dst_node[fanOut];
+    int order[num_nodes];
+    int k;
+
+    for (i = 0; i < fanOut; i++)
+      dst_node[i] = nodes[numa_share_owner(output[i] * sizeof(struct row_t),
+                                           bytes, nthreads)];
+    numa_shuffle_order(my_tid, nodes[my_tid], num_nodes, order);
+
+    for (k = 0; k < num_nodes; k++) {
+      for (i = 0; i < size; i++) {
+        uint32_t idx = ids[i];
+        if (dst_node[idx] == order[k]) {
+          tmp[dst[idx]] = rel[i];
+          ++dst[idx];
+        }
+      }
+    }
+    free(ids);
+    return;
   }
+
+  /* Copy tuples to their corresponding clusters */
+  radix_scatter(tmp, rel, ids, size, dst, fanOut);
+  free(ids);
 }
 
 /**
@@ -319,21 +359,17 @@ static void parallel_radix_partition(part_t *const part) {
 static void *prj_thread(void *param) {
   arg_t_radix *args = (arg_t_radix *)param;
   int32_t my_tid = args->my_tid;
+  args->scratch = scratch_self();
 
-  const int fanOut = 1 << (NUM_RADIX_BITS / NUM_PASSES);
-  const int R = (NUM_RADIX_BITS / NUM_PASSES);
-  const int D = (NUM_RADIX_BITS - (NUM_RADIX_BITS / NUM_PASSES));
-  const int thresh1 = (const int)(MAX((1 << D), (1 << R)) *
-                                  THRESHOLD1((unsigned long)args->nthreads));
+  const struct radix_params *params = &args->params;
+  const int fanOut = 1 << radix_pass_bits(params, 0);
 
   // if (args->my_tid == 0) {
-  //   printf("NUM_PASSES=%d, RADIX_BITS=%d\n", NUM_PASSES, NUM_RADIX_BITS);
-  //   printf("fanOut = %d, R = %d, D = %d, thresh1 = %d\n", fanOut, R, D,
-  //          thresh1);
+  //   printf("passes=%d, radix bits=%d\n", params->passes, params->bits);
+  //   printf("fanOut = %d\n", fanOut);
   // }
   uint64_t results = 0;
-  int i;
-  int rv = 0;
+  int i, k;
 
   part_t part;
   task_t *task;
@@ -344,8 +380,8 @@ static void *prj_thread(void *param) {
   int32_t *outputS = (int32_t *)calloc((fanOut + 1), sizeof(int32_t));
   malloc_check((void *)(outputR && outputS));
 
-  part_queue = args->part_queue;
-  join_queue = args->join_queue;
+  part_queue = args->queues[0];
+  join_queue = args->queues[params->passes - 1];
 
   args->histR[my_tid] = (int32_t *)calloc(fanOut, sizeof(int32_t));
   args->histS[my_tid] = (int32_t *)calloc(fanOut, sizeof(int32_t));
@@ -354,14 +390,27 @@ static void *prj_thread(void *param) {
 
   args->parts_processed = 0;
 
+  /* place this thread's share of the partition buffers on its node */
+  args->nodes[my_tid] = worker_pool_node();
+  {
+    const size_t bytesR =
+        args->totalR * sizeof(struct row_t) + radix_relation_padding(params);
+    const size_t bytesS =
+        args->totalS * sizeof(struct row_t) + radix_relation_padding(params);
+    numa_first_touch(args->tmpR, bytesR, my_tid, args->nthreads);
+    numa_first_touch(args->tmpS, bytesS, my_tid, args->nthreads);
+    numa_first_touch(args->tmpR2, bytesR, my_tid, args->nthreads);
+    numa_first_touch(args->tmpS2, bytesS, my_tid, args->nthreads);
+  }
+
   /* wait at a barrier until each thread starts and then start the timer */
-  barrier_arrive(args->barrier, rv);
+  worker_barrier_wait(args->barrier);
 
   /********** 1st pass of multi-pass partitioning ************/
   part.R = 0;
-  part.D = NUM_RADIX_BITS / NUM_PASSES;
+  part.D = radix_pass_bits(params, 0);
   part.thrargs = args;
-  part.padding = PADDING_TUPLES;
+  part.padding = radix_pass_padding(params, 0);
 
   /* 1. partitioning for relation R */
   part.rel = args->relR;
@@ -386,15 +435,15 @@ static void *prj_thread(void *param) {
   parallel_radix_partition(&part);
 
   /* wait at a barrier until each thread copies out */
-  barrier_arrive(args->barrier, rv);
+  worker_barrier_wait(args->barrier);
 
   /********** end of 1st partitioning phase ******************/
 
-  /* 3. first thread creates partitioning tasks for 2nd pass */
+  /* 3. first thread creates partitioning tasks for 2nd pass (or join tasks) */
   if (my_tid == 0) {
     for (i = 0; i < fanOut; i++) {
-      int32_t ntupR = outputR[i + 1] - outputR[i] - (int32_t)PADDING_TUPLES;
-      int32_t ntupS = outputS[i + 1] - outputS[i] - (int32_t)PADDING_TUPLES;
+      int32_t ntupR = outputR[i + 1] - outputR[i] - (int32_t)part.padding;
+      int32_t ntupS = outputS[i + 1] - outputS[i] - (int32_t)part.padding;
 
       if (ntupR > 0 && ntupS > 0) {
         task_t *t = task_queue_get_slot(part_queue);
@@ -416,34 +465,27 @@ static void *prj_thread(void *param) {
   }
 
   /* wait at a barrier until first thread adds all partitioning tasks */
-  barrier_arrive(args->barrier, rv);
-
-  /************ 2nd pass of multi-pass partitioning ********************/
-  /* 4. now each thread further partitions and add to join task queue **/
-
-#if NUM_PASSES == 1
-  /* If the partitioning is single pass we directly add tasks from pass-1 */
-  task_queue_t *swap = join_queue;
-  join_queue = part_queue;
-  /* part_queue is used as a temporary queue for handling skewed parts */
-  part_queue = swap;
-
-#elif NUM_PASSES == 2
+  worker_barrier_wait(args->barrier);
+
+  /************ further passes of multi-pass partitioning ********************/
+  /* 4. pass k + 1 partitions the pairs of pass k as parallel tasks, the last
+        pass adds them to the join task queue */
+  for (k = 1; k < params->passes; k++) {
+    while ((task = task_queue_get_atomic(args->queues[k - 1]))) {
+      serial_radix_partition(task, args->queues[k],
+                             radix_pass_shift(params, k),
+                             radix_pass_bits(params, k),
+                             radix_pass_padding(params, k),
+                             args->scratch);
+    }
 
-  while ((task = task_queue_get_atomic(part_queue))) {
-    serial_radix_partition(task, join_queue, R, D);
+    /* wait at a barrier until all threads add all tasks of this pass */
+    worker_barrier_wait(args->barrier);
   }
 
-#else
-#warning Only 2-pass partitioning is implemented, set NUM_PASSES to 2!
-#endif
-
   free(outputR);
   free(outputS);
 
-  /* wait at a barrier until all threads add all join tasks */
-  barrier_arrive(args->barrier, rv);
-
   // if (my_tid == 0) {
   //   printf("Number of join tasks = %d\n", join_queue->count);
   // }
@@ -455,15 +497,20 @@ static void *prj_thread(void *param) {
     //    i.e. bucket chaining, histogram-based, histogram-based with simd &
     //    prefetching  */
     results += args->join_function(&task->relR, &task->relS, &task->tmpR,
-                                   &output, args->expanded_tbl, args->bins);
+                                   &output, args->expanded_tbl, args->bins,
+                                   args->scratch, params->bits);
     args->parts_processed++;
   }
 
   args->result = results;
-  barrier_arrive(args->barrier, rv);
+  worker_barrier_wait(args->barrier);
   return 0;
 }
 
+static void prj_lane(void *param, int i) {
+  prj_thread(&((arg_t_radix *)param)[i]);
+}
+
 /**
  * The template function for different joins: Basically each parallel radix join
  * has a initialization step, partitioning step and build-probe steps. All our
@@ -479,46 +526,42 @@ static void *prj_thread(void *param) {
  */
 static result_t *join_init_run(struct table_t *relR, struct table_t *relS,
                                JoinFunctionIdx jf, int nthreads,
-                               struct table_t *expanded, int bins) {
-  int i, rv;
-  pthread_t tid[nthreads];
-  pthread_barrier_t barrier;
+                               struct table_t *expanded, int bins,
+                               const struct radix_params *params) {
+  int i;
+  worker_barrier_t barrier;
+
+  /* the threads meet at barriers, so all of them must run at once */
+  if (nthreads > worker_pool_team_size())
+    nthreads = worker_pool_team_size();
 
   arg_t_radix args[nthreads];
+  int32_t nodes[nthreads];
 
   int32_t **histR, **histS;
-  struct row_t *tmpRelR, *tmpRelS;
-  struct row_t *tmpRelR2, *tmpRelS2;
+  struct join_buffers *buffers;
   uint64_t numperthr[2];
   int64_t result = 0;
 
-  task_queue_t *part_queue, *join_queue;
-
-  part_queue = task_queue_init(FANOUT_PASS1);
-  join_queue = task_queue_init((1 << NUM_RADIX_BITS));
+  task_queue_t *queues[RADIX_MAX_PASSES];
+  const size_t relation_padding = radix_relation_padding(params);
 
-  /* allocate temporary space for partitioning */
-  tmpRelR = (struct row_t *)alloc_aligned(
-      relR->num_tuples * sizeof(struct row_t) + RELATION_PADDING);
-  tmpRelS = (struct row_t *)alloc_aligned(
-      relS->num_tuples * sizeof(struct row_t) + RELATION_PADDING);
-  malloc_check((void *)(tmpRelR && tmpRelS));
+  /* after pass k + 1 there are at most 2^(bits of passes 1 .. k + 1) pairs */
+  for (i = 0; i < params->passes; i++)
+    queues[i] = task_queue_init(
+        1 << (radix_pass_shift(params, i) + radix_pass_bits(params, i)));
 
-  tmpRelR2 = (struct row_t *)alloc_aligned(
-      relR->num_tuples * sizeof(struct row_t) + RELATION_PADDING);
-  tmpRelS2 = (struct row_t *)alloc_aligned(
-      relS->num_tuples * sizeof(struct row_t) + RELATION_PADDING);
+  /* temporary space for partitioning, kept from one join to the next */
+  buffers = join_arena_acquire(
+      relR->num_tuples * sizeof(struct row_t) + relation_padding,
+      relS->num_tuples * sizeof(struct row_t) + relation_padding);
 
   /* allocate histograms arrays, actual allocation is local to threads */
   histR = (int32_t **)alloc_aligned(nthreads * sizeof(int32_t *));
   histS = (int32_t **)alloc_aligned(nthreads * sizeof(int32_t *));
   malloc_check((void *)(histR && histS));
 
-  rv = pthread_barrier_init(&barrier, NULL, nthreads);
-  if (rv != 0) {
-    printf("Couldn't create the barrier\n");
-    exit(EXIT_FAILURE);
-  }
+  worker_barrier_init(&barrier, nthreads);
 
   /* first assign chunks of relR & relS for each thread */
   numperthr[0] = relR->num_tuples / nthreads;
@@ -530,18 +573,18 @@ static result_t *join_init_run(struct table_t *relR, struct table_t *relS,
       (threadresult_t *)malloc(sizeof(threadresult_t) * nthreads);
   for (i = 0; i < nthreads; i++) {
     args[i].relR = relR->tuples + i * numperthr[0];
-    args[i].tmpR = tmpRelR;
+    args[i].tmpR = buffers->tmpR;
     args[i].histR = histR;
 
     args[i].relS = relS->tuples + i * numperthr[1];
-    args[i].tmpS = tmpRelS;
+    args[i].tmpS = buffers->tmpS;
     args[i].histS = histS;
 
     /* Store original array pointers for propagation */
     args[i].origRelR = relR->tuples;
     args[i].origRelS = relS->tuples;
-    args[i].tmpR2 = tmpRelR2;
-    args[i].tmpS2 = tmpRelS2;
+    args[i].tmpR2 = buffers->tmpR2;
+    args[i].tmpS2 = buffers->tmpS2;
 
     args[i].expanded_tbl = expanded;
     args[i].bins = bins;
@@ -554,26 +597,19 @@ static result_t *join_init_run(struct table_t *relR, struct table_t *relS,
     args[i].totalS = relS->num_tuples;
 
     args[i].my_tid = i;
-    args[i].part_queue = part_queue;
-    args[i].join_queue = join_queue;
+    args[i].queues = queues;
 
     args[i].barrier = &barrier;
+    args[i].nodes = nodes;
     args[i].join_function = jf;
     args[i].nthreads = nthreads;
-
-    rv = pthread_create(&tid[i], NULL, prj_thread, (void *)&args[i]);
-
-    if (rv) {
-      printf("return code from pthread_create() is %d\n", rv);
-      exit(EXIT_FAILURE);
-    }
+    args[i].params = *params;
   }
 
-  /* wait for threads to finish */
-  for (i = 0; i < nthreads; i++) {
-    pthread_join(tid[i], NULL);
+  /* run the threads on the worker pool and wait for them to finish */
+  worker_pool_run(nthreads, prj_lane, args);
+  for (i = 0; i < nthreads; i++)
     result += args[i].result;
-  }
 
   joinresult->totalresults = result;
   joinresult->nthreads = nthreads;
@@ -587,32 +623,20 @@ static result_t *join_init_run(struct table_t *relR, struct table_t *relS,
   free(histS);
 
   /* Clean up task queues more carefully */
-  if (part_queue) {
-    task_queue_free(part_queue);
-  }
-  if (join_queue) {
-    task_queue_free(join_queue);
-  }
-
-  if (tmpRelR) {
-    free(tmpRelR);
-  }
-  if (tmpRelS) {
-    free(tmpRelS);
+  for (i = 0; i < params->passes; i++) {
+    if (queues[i]) {
+      task_queue_free(queues[i]);
+    }
   }
 
-  if (tmpRelR2) {
-    free(tmpRelR2);
-  }
-  if (tmpRelS2) {
-    free(tmpRelS2);
-  }
+  join_arena_return(buffers);
 
   return joinresult;
 }
 
 result_t *RHO_idx(struct table_t *relR, struct table_t *relS, int nthreads,
-                  struct table_t *expanded, int bins) {
+                  struct table_t *expanded, int bins,
+                  const struct radix_params *params) {
   return join_init_run(relR, relS, bucket_chaining_join_idx, nthreads, expanded,
-                       bins);
+                       bins, params);
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define _RADIX_JOIN_IDX_H_
 
 #include "data-types.h"
+#include "prj_params.h"
+#include "scratch.h"
 #include <stdbool.h>
 #include <stdlib.h>
 
@@ -9,9 +11,11 @@ typedef int64_t (*JoinFunctionIdx)(const struct table_t *const,
                                    const struct table_t *const,
                                    struct table_t *const,
                                    output_list_t **output,
-                                   struct table_t *expanded, int bins);
+                                   struct table_t *expanded, int bins,
+                                   struct scratch *scratch, int radix_bits);
 
 result_t *RHO_idx(struct table_t *relR, struct table_t *relS, int nthreads,
-                  struct table_t *expanded, int bins);
+                  struct table_t *expanded, int bins,
+                  const struct radix_params *params);
 
 #endif //_RADIX_JOIN_IDX_H_
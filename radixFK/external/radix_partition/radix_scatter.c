@@ -0,0 +1,220 @@
+#include "radix_scatter.h"
+#include "prj_params.h"
+#include "util.h"
+#include <immintrin.h>
+#include <malloc.h>
+#include <stdlib.h>
+
+#include <stddef.h>
+#include <string.h>
+
+/* histogram copies of the AVX2 histogram */
+#define HIST_COPIES 4
+
+/* hashKey of tuple i of a run whose hashKeys are stride bytes apart */
+#define HASH_KEY(K, STRIDE, I) (*(const uint32_t *)((K) + (I) * (STRIDE)))
+
+/* the row and tag versions share one body, inlined with a constant width so
+   that the copies compile to plain loads and stores */
+#define INLINE static inline __attribute__((always_inline))
+
+typedef struct {
+  char bytes[CACHE_LINE_SIZE];
+} __attribute__((aligned(CACHE_LINE_SIZE))) swwc_line_t;
+
+static enum radix_scatter_t scatter_mode = SCATTER_DIRECT;
+
+void radix_set_scatter(enum radix_scatter_t scatter) { scatter_mode = scatter; }
+
+enum radix_scatter_t radix_scatter_mode(void) { return scatter_mode; }
+
+static void histogram_scalar(const char *keys, size_t stride, uint64_t num,
+                             uint32_t mask, int shift, uint16_t *ids,
+                             uint32_t *hist) {
+  uint64_t i;
+  for (i = 0; i < num; i++) {
+    ids[i] = (uint16_t)((HASH_KEY(keys, stride, i) & mask) >> shift);
+    hist[ids[i]]++;
+  }
+}
+
+#ifdef __AVX2__
+/* the ids of 8 tuples at once, counted round-robin into HIST_COPIES copies */
+static void histogram_avx2(const char *keys, size_t stride, uint64_t num,
+                           uint32_t mask, int shift, uint16_t *ids,
+                           uint32_t *hist, uint32_t fanOut) {
+  const __m256i vmask = _mm256_set1_epi32((int)mask);
+  const __m128i vshift = _mm_cvtsi32_si128(shift);
+  uint32_t *h = (uint32_t *)calloc((size_t)HIST_COPIES * fanOut,
+                                   sizeof(uint32_t));
+  uint64_t i;
+  uint32_t p;
+
+  malloc_check(h);
+  for (i = 0; i + 8 <= num; i += 8) {
+    /* word loads and inserts beat a gather on the 16 and 32-byte tuples */
+    __m256i v = _mm256_setr_epi32(
+        (int)HASH_KEY(keys, stride, i), (int)HASH_KEY(keys, stride, i + 1),
+        (int)HASH_KEY(keys, stride, i + 2), (int)HASH_KEY(keys, stride, i + 3),
+        (int)HASH_KEY(keys, stride, i + 4), (int)HASH_KEY(keys, stride, i + 5),
+        (int)HASH_KEY(keys, stride, i + 6),
+        (int)HASH_KEY(keys, stride, i + 7));
+    v = _mm256_srl_epi32(_mm256_and_si256(v, vmask), vshift);
+    /* 8 x 32 -> 8 x 16 bits, packus works per 128-bit lane */
+    _mm_storeu_si128((__m128i *)(ids + i),
+                     _mm_packus_epi32(_mm256_castsi256_si128(v),
+                                      _mm256_extracti128_si256(v, 1)));
+    h[_mm256_extract_epi32(v, 0)]++;
+    h[fanOut + _mm256_extract_epi32(v, 1)]++;
+    h[2 * fanOut + _mm256_extract_epi32(v, 2)]++;
+    h[3 * fanOut + _mm256_extract_epi32(v, 3)]++;
+    h[_mm256_extract_epi32(v, 4)]++;
+    h[fanOut + _mm256_extract_epi32(v, 5)]++;
+    h[2 * fanOut + _mm256_extract_epi32(v, 6)]++;
+    h[3 * fanOut + _mm256_extract_epi32(v, 7)]++;
+  }
+  histogram_scalar(keys + i * stride, stride, num - i, mask, shift, ids + i,
+                   h);
+
+  for (p = 0; p < fanOut; p++)
+    hist[p] += h[p] + h[fanOut + p] + h[2 * fanOut + p] + h[3 * fanOut + p];
+  free(h);
+}
+#endif
+
+static void histogram(const char *keys, size_t stride, uint64_t num,
+                      uint32_t mask, int shift, uint16_t *ids, uint32_t *hist,
+                      uint32_t fanOut) {
+#ifdef __AVX2__
+  /* the copies only pay off on runs that are long next to the fan-out */
+  if (num >= (uint64_t)HIST_COPIES * fanOut) {
+    histogram_avx2(keys, stride, num, mask, shift, ids, hist, fanOut);
+    return;
+  }
+#endif
+  histogram_scalar(keys, stride, num, mask, shift, ids, hist);
+}
+
+void radix_histogram(const struct row_t *rel, uint64_t num, uint32_t mask,
+                     int shift, uint16_t *ids, uint32_t *hist,
+                     uint32_t fanOut) {
+  histogram((const char *)rel + offsetof(struct row_t, hashKey),
+            sizeof(struct row_t), num, mask, shift, ids, hist, fanOut);
+}
+
+void radix_histogram_tags(const struct tag_t *tags, uint64_t num,
+                          uint32_t mask, int shift, uint16_t *ids,
+                          uint32_t *hist, uint32_t fanOut) {
+  histogram((const char *)tags + offsetof(struct tag_t, hashKey),
+            sizeof(struct tag_t), num, mask, shift, ids, hist, fanOut);
+}
+
+INLINE void scatter_direct(char *out, const char *rel, size_t width,
+                           const uint16_t *ids, uint64_t num, uint32_t *dst) {
+  uint64_t i;
+  for (i = 0; i < num; i++) {
+    memcpy(out + (size_t)dst[ids[i]] * width, rel + i * width, width);
+    ++dst[ids[i]];
+  }
+}
+
+/* writes a full buffered line to its (line-aligned) place, bypassing caches */
+static inline void stream_line(char *to, const swwc_line_t *line) {
+#ifdef __AVX__
+  const __m256i *src = (const __m256i *)line;
+  __m256i *dst = (__m256i *)to;
+  int k;
+  for (k = 0; k < (int)(sizeof(swwc_line_t) / sizeof(__m256i)); k++)
+    _mm256_stream_si256(dst + k, _mm256_load_si256(src + k));
+#else
+  const __m128i *src = (const __m128i *)line;
+  __m128i *dst = (__m128i *)to;
+  int k;
+  for (k = 0; k < (int)(sizeof(swwc_line_t) / sizeof(__m128i)); k++)
+    _mm_stream_si128(dst + k, _mm_load_si128(src + k));
+#endif
+}
+
+INLINE void scatter_swwc(char *out, const char *rel, size_t width,
+                         const uint16_t *ids, uint64_t num, uint32_t *dst,
+                         uint32_t fanOut) {
+  const uint32_t per_line = (uint32_t)(CACHE_LINE_SIZE / width);
+  /* slot of out[0] within its cache line: buf[p] mirrors the line of out
+     that dst[p] falls into */
+  const uint32_t lead = (uint32_t)((uintptr_t)out / width) & (per_line - 1);
+  swwc_line_t *buf =
+      (swwc_line_t *)memalign(CACHE_LINE_SIZE, fanOut * sizeof(swwc_line_t));
+  uint32_t *start = (uint32_t *)malloc(fanOut * sizeof(uint32_t));
+  uint64_t i;
+  uint32_t p, j;
+
+  malloc_check(buf);
+  malloc_check(start);
+  for (p = 0; p < fanOut; p++)
+    start[p] = dst[p];
+
+  for (i = 0; i < num; i++) {
+    p = ids[i];
+    const uint32_t d = dst[p]++;
+    const uint32_t slot = (lead + d) & (per_line - 1);
+    memcpy(buf[p].bytes + slot * width, rel + i * width, width);
+    if (slot == per_line - 1) {
+      if (d + 1 - start[p] >= per_line) {
+        stream_line(out + (size_t)(d + 1 - per_line) * width, &buf[p]);
+      } else {
+        /* first line of the run, partly another run's */
+        for (j = start[p]; j <= d; j++)
+          memcpy(out + (size_t)j * width,
+                 buf[p].bytes + ((lead + j) & (per_line - 1)) * width, width);
+      }
+    }
+  }
+
+  /* flush the partly filled last lines */
+  for (p = 0; p < fanOut; p++) {
+    const uint32_t d = dst[p];
+    const uint32_t fill = (lead + d) & (per_line - 1);
+    j = d >= fill && d - fill > start[p] ? d - fill : start[p];
+    for (; j < d; j++)
+      memcpy(out + (size_t)j * width,
+             buf[p].bytes + ((lead + j) & (per_line - 1)) * width, width);
+  }
+
+  /* the streamed lines are visible to the other threads after the barrier */
+  _mm_sfence();
+  free(buf);
+  free(start);
+}
+
+void radix_scatter(struct row_t *out, const struct row_t *rel,
+                   const uint16_t *ids, uint64_t num, uint32_t *dst,
+                   uint32_t fanOut) {
+  if (scatter_mode == SCATTER_SWWC)
+    radix_scatter_swwc(out, rel, ids, num, dst, fanOut);
+  else
+    radix_scatter_direct(out, rel, ids, num, dst);
+}
+
+void radix_scatter_direct(struct row_t *out, const struct row_t *rel,
+                          const uint16_t *ids, uint64_t num, uint32_t *dst) {
+  scatter_direct((char *)out, (const char *)rel, sizeof(struct row_t), ids,
+                 num, dst);
+}
+
+void radix_scatter_swwc(struct row_t *out, const struct row_t *rel,
+                        const uint16_t *ids, uint64_t num, uint32_t *dst,
+                        uint32_t fanOut) {
+  scatter_swwc((char *)out, (const char *)rel, sizeof(struct row_t), ids, num,
+               dst, fanOut);
+}
+
+void radix_scatter_tags(struct tag_t *out, const struct tag_t *tags,
+                        const uint16_t *ids, uint64_t num, uint32_t *dst,
+                        uint32_t fanOut) {
+  if (scatter_mode == SCATTER_SWWC)
+    scatter_swwc((char *)out, (const char *)tags, sizeof(struct tag_t), ids,
+                 num, dst, fanOut);
+  else
+    scatter_direct((char *)out, (const char *)tags, sizeof(struct tag_t), ids,
+                   num, dst);
+}
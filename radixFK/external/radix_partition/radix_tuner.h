@@ -0,0 +1,48 @@
+#ifndef RADIX_TUNER_H
+#define RADIX_TUNER_H
+
+#include "prj_params.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Run-time choice of the radix bits and passes (struct radix_params).
+ *
+ * The cache geometry comes from /sys/devices/system/cpu/cpu0/cache, else from
+ * sysconf, else from prj_params.h. radix_autotune then picks
+ *
+ *   - enough bits that a partition of the smaller relation, its bin layout
+ *     included, fills at most half of L2, and at least 4 join tasks per
+ *     thread,
+ *   - but no more than leave every partition enough rows for Lemma 1
+ *     (m * exp(-n / m) <= p, findMaxBins in main.cpp) with 16 bins,
+ *   - and as many passes as it takes to keep the fan-out of a pass within
+ *     the L1 cache lines and the TLB, at most RADIX_MAX_PASSES.
+ */
+
+/** most radix bits of one pass; larger fan-outs overflow the scatter state */
+#define RADIX_MAX_PASS_BITS 16
+/** most radix bits in total; the join queue holds a task per partition */
+#define RADIX_MAX_BITS 24
+
+struct cache_geometry {
+  size_t line_size;
+  size_t l1_size;
+  unsigned l1_assoc;
+  size_t l2_size;
+};
+
+void cache_geometry_detect(struct cache_geometry *geo);
+
+/* NUM_RADIX_BITS and NUM_PASSES of the build */
+struct radix_params radix_default_params(void);
+
+/* whether the partitioning can run with p */
+bool radix_params_valid(const struct radix_params *p);
+
+/* parameters for joining numR with numS rows on nthreads threads */
+struct radix_params radix_autotune(uint64_t numR, uint64_t numS, int nthreads,
+                                   const struct cache_geometry *geo);
+
+#endif /* RADIX_TUNER_H */
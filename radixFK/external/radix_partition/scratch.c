@@ -0,0 +1,65 @@
+#include "scratch.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static __thread struct scratch self;
+
+/* every arena handed out, for scratch_release */
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct scratch **arenas;
+static int num_arenas, cap_arenas;
+
+struct scratch *scratch_self(void) {
+  if (!self.registered) {
+    pthread_mutex_lock(&arenas_lock);
+    if (num_arenas == cap_arenas) {
+      cap_arenas = cap_arenas ? 2 * cap_arenas : 16;
+      arenas = (struct scratch **)realloc(arenas,
+                                          cap_arenas * sizeof(*arenas));
+      malloc_check(arenas);
+    }
+    arenas[num_arenas++] = &self;
+    pthread_mutex_unlock(&arenas_lock);
+    self.registered = 1;
+  }
+  return &self;
+}
+
+void scratch_reset(struct scratch *s, size_t bytes) {
+  s->used = 0;
+  if (bytes <= s->size)
+    return;
+  /* grow by half at least, so that a few larger tasks do not realloc each */
+  if (bytes < s->size + s->size / 2)
+    bytes = s->size + s->size / 2;
+  bytes = SCRATCH_ROOM(bytes);
+  free(s->base);
+  s->base = (char *)aligned_alloc(SCRATCH_ALIGN, bytes);
+  malloc_check(s->base);
+  s->size = bytes;
+}
+
+void *scratch_alloc(struct scratch *s, size_t bytes) {
+  void *p = s->base + s->used;
+  bytes = SCRATCH_ROOM(bytes);
+  if (s->used + bytes > s->size) {
+    printf("scratch: %zu bytes asked, %zu of %zu left\n", bytes,
+           s->size - s->used, s->size);
+    exit(EXIT_FAILURE);
+  }
+  s->used += bytes;
+  return p;
+}
+
+void scratch_release(void) {
+  int i;
+  pthread_mutex_lock(&arenas_lock);
+  for (i = 0; i < num_arenas; i++) {
+    free(arenas[i]->base);
+    arenas[i]->base = NULL;
+    arenas[i]->size = arenas[i]->used = 0;
+  }
+  pthread_mutex_unlock(&arenas_lock);
+}
@@ -10,45 +10,34 @@
 
 #include "task_queue.h"
 
-#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "data-types.h"
+#include "util.h"
 
 inline 
 task_t * 
 task_queue_get_atomic(task_queue_t * tq) 
 {
-    pthread_mutex_lock(&tq->lock);
-    task_t * ret = 0;
-    if(tq->count > 0){
-        ret      = tq->head;
-        tq->head = ret->next;
-        tq->count --;
-    }
-    pthread_mutex_unlock(&tq->lock);
-
-    return ret;
+    /* count is final once the queue is drained (see task_queue.h) */
+    int32_t i = __atomic_fetch_add(&tq->next, 1, __ATOMIC_RELAXED);
+    return i < tq->count ? &tq->tasks[i] : 0;
 }
 
 inline 
 void 
 task_queue_add_atomic(task_queue_t * tq, task_t * t) 
 {
-    pthread_mutex_lock(&tq->lock);
-    t->next  = tq->head;
-    tq->head = t;
-    tq->count ++;
-    pthread_mutex_unlock(&tq->lock);
-
+    (void) t;
+    __atomic_add_fetch(&tq->count, 1, __ATOMIC_RELAXED);
 }
 
 inline 
 void 
 task_queue_add(task_queue_t * tq, task_t * t) 
 {
-    t->next  = tq->head;
-    tq->head = t;
+    (void) t;
     tq->count ++;
 }
 
@@ -56,33 +45,26 @@ inline
 void 
 task_queue_copy_atomic(task_queue_t * tq, task_t * t) 
 {
-    pthread_mutex_lock(&tq->lock);
-    task_t * slot = task_queue_get_slot(tq);
+    task_t * slot = task_queue_get_slot_atomic(tq);
     *slot = *t; /* copy */
-    task_queue_add(tq, slot);
-    pthread_mutex_unlock(&tq->lock);
+    task_queue_add_atomic(tq, slot);
+}
+
+static task_t * 
+task_queue_slot(task_queue_t * tq, int32_t i)
+{
+    if(i >= tq->capacity) {
+        printf("Task queue overflow: more than %d tasks\n", tq->capacity);
+        exit(EXIT_FAILURE);
+    }
+    return &tq->tasks[i];
 }
 
 inline 
 task_t * 
 task_queue_get_slot(task_queue_t * tq)
 {
-    task_list_t * l = tq->free_list;
-    task_t * ret;
-    if(l->curr < tq->alloc_size) {
-        ret = &(l->tasks[l->curr]);
-        l->curr++;
-    }
-    else {
-        task_list_t * nl = (task_list_t*) malloc(sizeof(task_list_t));
-        nl->tasks = (task_t*) malloc(tq->alloc_size * sizeof(task_t));
-        nl->curr = 1;
-        nl->next = tq->free_list;
-        tq->free_list = nl;
-        ret = &(nl->tasks[0]);
-    }
-
-    return ret;
+    return task_queue_slot(tq, tq->reserved++);
 }
 
 /* get a free slot of task_t */
@@ -90,27 +72,22 @@ inline
 task_t * 
 task_queue_get_slot_atomic(task_queue_t * tq)
 {
-    pthread_mutex_lock(&tq->alloc_lock);
-    task_t * ret = task_queue_get_slot(tq);
-    pthread_mutex_unlock(&tq->alloc_lock);
-
-    return ret;
+    return task_queue_slot(tq,
+            __atomic_fetch_add(&tq->reserved, 1, __ATOMIC_RELAXED));
 }
 
-/* initialize a task queue with given allocation block size */
+/* initialize a task queue that holds up to capacity tasks */
 task_queue_t * 
-task_queue_init(int alloc_size) 
+task_queue_init(int capacity) 
 {
     task_queue_t * ret = (task_queue_t*) malloc(sizeof(task_queue_t));
-    ret->free_list = (task_list_t*) malloc(sizeof(task_list_t));
-    ret->free_list->tasks = (task_t*) malloc(alloc_size * sizeof(task_t));
-    ret->free_list->curr = 0;
-    ret->free_list->next = NULL;
-    ret->count      = 0;
-    ret->alloc_size = alloc_size;
-    ret->head       = NULL;
-    pthread_mutex_init(&ret->lock, NULL);
-    pthread_mutex_init(&ret->alloc_lock, NULL);
+    malloc_check(ret);
+    ret->tasks = (task_t*) malloc(capacity * sizeof(task_t));
+    malloc_check(ret->tasks);
+    ret->capacity = capacity;
+    ret->reserved = 0;
+    ret->count    = 0;
+    ret->next     = 0;
 
     return ret;
 }
@@ -118,12 +95,6 @@ task_queue_init(int alloc_size)
 void 
 task_queue_free(task_queue_t * tq) 
 {
-    task_list_t * tmp = tq->free_list;
-    while(tmp) {
-        free(tmp->tasks);
-        task_list_t * tmp2 = tmp->next;
-        free(tmp);
-        tmp = tmp2;
-    }
+    free(tq->tasks);
     free(tq);
-}
\ No newline at end of file
+}
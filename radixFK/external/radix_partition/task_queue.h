@@ -10,7 +10,6 @@
 #ifndef TASK_QUEUE_H
 #define TASK_QUEUE_H
 
-#include <pthread.h>
 #include <stdlib.h>
 
 #include "data-types.h" 
@@ -20,31 +19,35 @@
  * @{
  */
 
+/*
+ * The number of tasks a queue ever holds is known up front (one partitioning
+ * task per pass-1 partition, at most 2^bits join tasks), so a queue is
+ * one preallocated task array driven by atomic cursors instead of a locked
+ * list: getting a slot bumps `reserved', adding bumps `count' and getting a
+ * task bumps `next'. None of them takes a lock.
+ *
+ * A queue is filled in one phase and drained in the next: tasks may only be
+ * taken once every slot handed out so far has been added, which the join
+ * guarantees with the barrier between the two.
+ */
+
 typedef struct task_t task_t;
-typedef struct task_list_t task_list_t;
 typedef struct task_queue_t task_queue_t;
 
+/* the counts join (RHO) partitions and joins tags, see struct tag_t */
 struct task_t {
-    struct table_t relR;
-    struct table_t tmpR;
-    struct table_t relS;
-    struct table_t tmpS;
-    task_t *   next;
-};
-
-struct task_list_t {
-    task_t *      tasks;
-    task_list_t * next;
-    int           curr;
+    union { struct table_t relR; struct tag_table_t tagR; };
+    union { struct table_t tmpR; struct tag_table_t tagTmpR; };
+    union { struct table_t relS; struct tag_table_t tagS; };
+    union { struct table_t tmpS; struct tag_table_t tagTmpS; };
 };
 
 struct task_queue_t {
-    pthread_mutex_t lock;
-    pthread_mutex_t alloc_lock;
-    task_t *        head;
-    task_list_t *   free_list;
+    task_t *        tasks;
+    int32_t         capacity;
+    int32_t         reserved;
     int32_t         count;
-    int32_t         alloc_size;
+    int32_t         next;
 };
 
 inline 
@@ -59,27 +62,16 @@ inline
 task_t * 
 get_next_task(task_queue_t * tq) 
 {
-    pthread_mutex_lock(&tq->lock);
-    task_t * ret = 0;
-    if(tq->count > 0){
-        ret = tq->head;
-        tq->head = ret->next;
-        tq->count --;
-    }
-    pthread_mutex_unlock(&tq->lock);
-
-    return ret;
+    int32_t i = __atomic_fetch_add(&tq->next, 1, __ATOMIC_RELAXED);
+    return i < tq->count ? &tq->tasks[i] : 0;
 }
 
 inline 
 void 
 add_tasks(task_queue_t * tq, task_t * t) 
 {
-    pthread_mutex_lock(&tq->lock);
-    t->next = tq->head;
-    tq->head = t;
-    tq->count ++;
-    pthread_mutex_unlock(&tq->lock);
+    (void) t;
+    __atomic_add_fetch(&tq->count, 1, __ATOMIC_RELAXED);
 }
 
 /* atomically get the next available task */
@@ -103,9 +95,9 @@ task_queue_get_slot_atomic(task_queue_t * tq);
 task_t * 
 task_queue_get_slot(task_queue_t * tq);
 
-/* initialize a task queue with given allocation block size */
+/* initialize a task queue that holds up to capacity tasks */
 task_queue_t * 
-task_queue_init(int alloc_size);
+task_queue_init(int capacity);
 
 void 
 task_queue_free(task_queue_t * tq);
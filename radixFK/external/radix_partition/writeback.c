@@ -0,0 +1,96 @@
+#include "writeback.h"
+#include "prj_params.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* keep a few blocks per thread, for the balance of writeback_apply */
+#define BLOCKS_PER_THREAD 4
+
+void writeback_init(struct writeback *wb, struct row_t *orig, uint64_t total,
+                    size_t offset, size_t from, size_t size, int nthreads) {
+  int shift = 0;
+
+  while (((size_t)2 << shift) * sizeof(struct row_t) <= L2_CACHE_SIZE / 2)
+    shift++;
+  while (shift > 0 && (total >> shift) < (uint64_t)BLOCKS_PER_THREAD * nthreads)
+    shift--;
+
+  wb->orig = orig;
+  wb->offset = offset;
+  wb->from = from;
+  wb->size = size;
+  wb->shift = shift;
+  wb->blocks = (uint32_t)((total + ((uint64_t)1 << shift) - 1) >> shift);
+  wb->nthreads = nthreads;
+  wb->shares = (struct writeback_share *)calloc(
+      nthreads, sizeof(struct writeback_share));
+  malloc_check(wb->shares);
+  wb->next = 0;
+}
+
+void writeback_free(struct writeback *wb) {
+  int t;
+  for (t = 0; t < wb->nthreads; t++) {
+    free(wb->shares[t].pairs);
+    free(wb->shares[t].start);
+  }
+  free(wb->shares);
+}
+
+void writeback_collect(struct writeback *wb, int tid, const task_t *tasks,
+                       int ntasks, int side) {
+  struct writeback_share *share = &wb->shares[tid];
+  const int first = (int)((int64_t)ntasks * tid / wb->nthreads);
+  const int last = (int)((int64_t)ntasks * (tid + 1) / wb->nthreads);
+  uint32_t *dst = (uint32_t *)calloc(wb->blocks + 1, sizeof(uint32_t));
+  uint32_t b, num = 0;
+  uint64_t i;
+  int k;
+
+  share->start = (uint32_t *)malloc((wb->blocks + 1) * sizeof(uint32_t));
+  malloc_check(dst);
+  malloc_check(share->start);
+
+  for (k = first; k < last; k++) {
+    const struct tag_table_t *rel = side ? &tasks[k].tagS : &tasks[k].tagR;
+    for (i = 0; i < rel->num_tags; i++)
+      dst[TAG_IDX(rel->tags[i]) >> wb->shift]++;
+  }
+  for (b = 0; b < wb->blocks; b++) {
+    share->start[b] = num;
+    num += dst[b];
+    dst[b] = share->start[b];
+  }
+  share->start[wb->blocks] = num;
+
+  share->pairs = (struct writeback_pair *)malloc(
+      (num ? num : 1) * sizeof(struct writeback_pair));
+  malloc_check(share->pairs);
+  for (k = first; k < last; k++) {
+    const struct tag_table_t *rel = side ? &tasks[k].tagS : &tasks[k].tagR;
+    for (i = 0; i < rel->num_tags; i++) {
+      const uint32_t idx = TAG_IDX(rel->tags[i]);
+      struct writeback_pair *p = &share->pairs[dst[idx >> wb->shift]++];
+      p->idx = idx;
+      p->value = 0;
+      memcpy(&p->value, (const char *)&rel->tags[i] + wb->from, wb->size);
+    }
+  }
+  free(dst);
+}
+
+void writeback_apply(struct writeback *wb) {
+  uint32_t b;
+  int t;
+  while ((b = __atomic_fetch_add(&wb->next, 1, __ATOMIC_RELAXED)) <
+         wb->blocks) {
+    for (t = 0; t < wb->nthreads; t++) {
+      const struct writeback_share *share = &wb->shares[t];
+      uint32_t j;
+      for (j = share->start[b]; j < share->start[b + 1]; j++)
+        memcpy((char *)&wb->orig[share->pairs[j].idx] + wb->offset,
+               &share->pairs[j].value, wb->size);
+    }
+  }
+}
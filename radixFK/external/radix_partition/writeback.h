@@ -0,0 +1,57 @@
+#ifndef WRITEBACK_H
+#define WRITEBACK_H
+
+#include "data-types.h"
+#include "task_queue.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Write-back of a field that the counts join computed in the tags of its
+ * tasks (see struct tag_t) to the original rows.
+ *
+ * Writing a task's tags back to orig[idx] right after the join is a random
+ * write per row over the whole relation. Instead, once all tasks are joined,
+ * every thread collects (idx, field) pairs from its share of the tasks,
+ * partitioned by block of the original relation, a block being the rows
+ * that fill half of L2. The threads then apply the pairs block by block, so
+ * the writes of a block stay within L2 and its TLB entries.
+ *
+ * writeback_init runs before the threads, writeback_collect on every
+ * thread, then after a barrier writeback_apply on every thread.
+ */
+struct writeback_pair {
+  uint32_t idx;
+  uint64_t value;
+};
+
+struct writeback_share {
+  struct writeback_pair *pairs;
+  uint32_t *start; /* first pair of every block, blocks + 1 entries */
+};
+
+struct writeback {
+  struct row_t *orig;
+  size_t offset, size; /* of the field within the rows */
+  size_t from;         /* of the field within the tags */
+  int shift;           /* block of a row: idx >> shift */
+  uint32_t blocks;
+  int nthreads;
+  struct writeback_share *shares;
+  uint32_t next; /* next block to apply */
+};
+
+/* write-back of the size bytes at offset of every row of orig[0 .. total),
+   taken from the size bytes at from of its tag */
+void writeback_init(struct writeback *wb, struct row_t *orig, uint64_t total,
+                    size_t offset, size_t from, size_t size, int nthreads);
+void writeback_free(struct writeback *wb);
+
+/* pairs of the R (side 0) or S (side 1) tags of thread tid's share of tasks */
+void writeback_collect(struct writeback *wb, int tid, const task_t *tasks,
+                       int ntasks, int side);
+
+/* writes the collected pairs, the blocks shared out among the callers */
+void writeback_apply(struct writeback *wb);
+
+#endif /* WRITEBACK_H */
@@ -0,0 +1,425 @@
+#define _GNU_SOURCE
+#include "worker_pool.h"
+#include <dirent.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define SPIN_ITERATIONS 2048
+
+#define PAUSE() asm("pause")
+
+struct job {
+    void (*fn)(void *arg, int i);
+    void *arg;
+    int count;
+    int width;
+    unsigned int remaining;
+    struct worker *owner;
+};
+
+struct worker {
+    pthread_t thread;
+    int id;
+    int cpu;
+    int node;
+
+    /* mailbox: filled by the poster, then published by bumping seq */
+    struct job *job;
+    int lane;
+    int team;
+    unsigned int seq;
+    unsigned int seq_sleepers;
+
+    /* bumped by the last lane of every job this worker posted */
+    unsigned int done;
+    unsigned int done_sleepers;
+} __attribute__((aligned(64)));
+
+static struct worker *workers;
+static int num_workers;
+static int spin_iterations;
+static int num_nodes = 1;
+
+static _Thread_local int self;
+static _Thread_local int team;
+
+static void futex_wait(unsigned int *word, unsigned int val) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(unsigned int *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Waits until *word != old: spins first, then sleeps on the futex. */
+static void wait_change(unsigned int *word, unsigned int old,
+        unsigned int *sleepers) {
+    for (int i = 0; i < spin_iterations; i++) {
+        if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != old) {
+            return;
+        }
+        PAUSE();
+    }
+    __atomic_add_fetch(sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(word, __ATOMIC_SEQ_CST) == old) {
+        futex_wait(word, old);
+    }
+    __atomic_sub_fetch(sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+static void bump(unsigned int *word, unsigned int *sleepers) {
+    __atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(sleepers, __ATOMIC_SEQ_CST)) {
+        futex_wake(word);
+    }
+}
+
+static void pin(int id) {
+    if (workers[id].cpu < 0) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(workers[id].cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* Reads a sysfs cpulist such as "0-3,8-11" into set. */
+static void read_cpulist(const char *path, cpu_set_t *set) {
+    CPU_ZERO(set);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return;
+    }
+    int lo, hi;
+    char sep;
+    while (fscanf(f, "%d", &lo) == 1) {
+        hi = lo;
+        if (fscanf(f, "%c", &sep) == 1 && sep == '-') {
+            if (fscanf(f, "%d", &hi) != 1) {
+                break;
+            }
+            if (fscanf(f, "%c", &sep) != 1) {
+                sep = '\n';
+            }
+        }
+        for (int c = lo; c <= hi && c < CPU_SETSIZE; c++) {
+            CPU_SET(c, set);
+        }
+        if (sep != ',') {
+            break;
+        }
+    }
+    fclose(f);
+}
+
+/*
+ * Groups the CPUs we may run on by NUMA node (from sysfs, so libnuma is not
+ * needed) and spreads the workers over the nodes in contiguous blocks: the
+ * workers of one node have consecutive ids, and so do the sub-teams of a
+ * worker_pool_run. Within a node the workers take its CPUs round-robin.
+ */
+static void place_workers(int n) {
+    cpu_set_t allowed;
+    for (int i = 0; i < n; i++) {
+        workers[i].cpu = -1;
+        workers[i].node = 0;
+    }
+    num_nodes = 1;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        return;
+    }
+
+    /* the CPUs of every node that has any we may use, in node order */
+    int *node_cpus = malloc(CPU_COUNT(&allowed) * sizeof(*node_cpus));
+    int *node_begin = malloc((CPU_COUNT(&allowed) + 1) * sizeof(*node_begin));
+    if (!node_cpus || !node_begin) {
+        free(node_cpus);
+        free(node_begin);
+        return;
+    }
+    cpu_set_t seen;
+    CPU_ZERO(&seen);
+    int nodes = 0, k = 0, max_node = -1;
+    DIR *dir = opendir("/sys/devices/system/node");
+    struct dirent *ent;
+    while (dir && (ent = readdir(dir))) {
+        int id;
+        if (sscanf(ent->d_name, "node%d", &id) == 1 && id > max_node) {
+            max_node = id;
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    for (int id = 0; id <= max_node; id++) {
+        char path[64];
+        snprintf(path, sizeof(path),
+                "/sys/devices/system/node/node%d/cpulist", id);
+        cpu_set_t set;
+        read_cpulist(path, &set);
+        CPU_AND(&set, &set, &allowed);
+        const int first = k;
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &set) && !CPU_ISSET(c, &seen)) {
+                CPU_SET(c, &seen);
+                node_cpus[k++] = c;
+            }
+        }
+        if (k > first) {
+            node_begin[nodes++] = first;
+        }
+    }
+    /* CPUs sysfs did not place on a node (or no sysfs at all) */
+    const int first = k;
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &allowed) && !CPU_ISSET(c, &seen)) {
+            node_cpus[k++] = c;
+        }
+    }
+    if (k > first) {
+        node_begin[nodes++] = first;
+    }
+    node_begin[nodes] = k;
+
+    if (nodes > n) {
+        nodes = n;
+    }
+    for (int i = 0; i < n; i++) {
+        const int node = (int) ((long) i * nodes / n);
+        const int rank = i - (int) (((long) node * n + nodes - 1) / nodes);
+        const int count = node_begin[node + 1] - node_begin[node];
+        workers[i].node = node;
+        workers[i].cpu = node_cpus[node_begin[node] + rank % count];
+    }
+    num_nodes = nodes;
+    free(node_cpus);
+    free(node_begin);
+}
+
+/* Waits until every lane of a job this worker posted is done. Several jobs
+   may share the done word (a job and the other half of an invoke2 around it),
+   so a bump only means that some job finished. */
+static void wait_job(struct worker *me, struct job *job) {
+    for (;;) {
+        const unsigned int done = __atomic_load_n(&me->done, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&job->remaining, __ATOMIC_SEQ_CST)) {
+            return;
+        }
+        wait_change(&me->done, done, &me->done_sleepers);
+    }
+}
+
+static void run_lane(struct job *job, int lane, int lane_team) {
+    int saved = team;
+    team = lane_team;
+    for (int i = lane; i < job->count; i += job->width) {
+        job->fn(job->arg, i);
+    }
+    team = saved;
+}
+
+static void finish_lane(struct job *job) {
+    /* the job lives on the owner's stack: read everything before the
+       decrement that may let the owner return */
+    struct worker *owner = job->owner;
+    if (!__atomic_sub_fetch(&job->remaining, 1, __ATOMIC_ACQ_REL)) {
+        bump(&owner->done, &owner->done_sleepers);
+    }
+}
+
+static void post(struct worker *w, struct job *job, int lane, int lane_team) {
+    w->job = job;
+    w->lane = lane;
+    w->team = lane_team;
+    bump(&w->seq, &w->seq_sleepers);
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    unsigned int seen = 0;
+
+    pin(w->id);
+    self = w->id;
+    team = 1;
+    for (;;) {
+        wait_change(&w->seq, seen, &w->seq_sleepers);
+        seen = __atomic_load_n(&w->seq, __ATOMIC_ACQUIRE);
+        struct job *job = w->job;
+        if (!job) {
+            break;
+        }
+        run_lane(job, w->lane, w->team);
+        finish_lane(job);
+    }
+    return NULL;
+}
+
+void worker_pool_init(int n) {
+    if (workers) {
+        return;
+    }
+    if (n < 1) {
+        n = 1;
+    }
+
+    if (posix_memalign((void **)&workers, 64, n * sizeof(*workers))) {
+        printf("Couldn't allocate the worker pool\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(workers, 0, n * sizeof(*workers));
+    num_workers = n;
+    place_workers(n);
+
+    /* spinning only pays off while every worker has a CPU of its own */
+    cpu_set_t set;
+    spin_iterations = (!sched_getaffinity(0, sizeof(set), &set)
+            && CPU_COUNT(&set) >= n) ? SPIN_ITERATIONS : 0;
+
+    workers[0].id = 0;
+    workers[0].thread = pthread_self();
+    pin(0);
+    self = 0;
+    team = n;
+    for (int i = 1; i < n; i++) {
+        workers[i].id = i;
+        int rv = pthread_create(&workers[i].thread, NULL, worker_main,
+                &workers[i]);
+        if (rv) {
+            printf("return code from pthread_create() is %d\n", rv);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void worker_pool_shutdown(void) {
+    if (!workers) {
+        return;
+    }
+    for (int i = 1; i < num_workers; i++) {
+        post(&workers[i], NULL, 0, 0);
+        pthread_join(workers[i].thread, NULL);
+    }
+    free(workers);
+    workers = NULL;
+    num_workers = 0;
+    num_nodes = 1;
+    team = 0;
+}
+
+int worker_pool_size(void) {
+    return workers ? num_workers : 1;
+}
+
+int worker_pool_num_nodes(void) {
+    return num_nodes;
+}
+
+int worker_pool_node(void) {
+    return workers ? workers[self].node : 0;
+}
+
+int worker_pool_team_size(void) {
+    return (workers && team > 0) ? team : 1;
+}
+
+void worker_pool_run(int count, void (*fn)(void *arg, int i), void *arg) {
+    const int t = worker_pool_team_size();
+    const int width = count < t ? count : t;
+
+    if (width <= 1) {
+        for (int i = 0; i < count; i++) {
+            fn(arg, i);
+        }
+        return;
+    }
+
+    struct worker *me = &workers[self];
+    struct job job = {
+        .fn = fn,
+        .arg = arg,
+        .count = count,
+        .width = width,
+        .remaining = width - 1,
+        .owner = me,
+    };
+    for (int k = 1; k < width; k++) {
+        const int begin = k * t / width;
+        const int end = (k + 1) * t / width;
+        post(&workers[self + begin], &job, k, end - begin);
+    }
+    run_lane(&job, 0, t / width);
+    wait_job(me, &job);
+}
+
+struct single {
+    void (*fn)(void *);
+    void *arg;
+};
+
+static void run_single(void *arg, int i) {
+    (void)i;
+    struct single *s = arg;
+    s->fn(s->arg);
+}
+
+void worker_pool_invoke2(int width_a, void (*fn_a)(void *), void *arg_a,
+        void (*fn_b)(void *), void *arg_b) {
+    const int t = worker_pool_team_size();
+
+    if (t < 2) {
+        fn_a(arg_a);
+        fn_b(arg_b);
+        return;
+    }
+    if (width_a < 1) {
+        width_a = 1;
+    }
+    if (width_a > t - 1) {
+        width_a = t - 1;
+    }
+
+    struct worker *me = &workers[self];
+    struct single b = { .fn = fn_b, .arg = arg_b };
+    struct job job = {
+        .fn = run_single,
+        .arg = &b,
+        .count = 1,
+        .width = 1,
+        .remaining = 1,
+        .owner = me,
+    };
+    post(&workers[self + width_a], &job, 0, t - width_a);
+
+    const int saved = team;
+    team = width_a;
+    fn_a(arg_a);
+    team = saved;
+    wait_job(me, &job);
+}
+
+void worker_barrier_init(worker_barrier_t *barrier, unsigned int count) {
+    barrier->count = count;
+    barrier->arrived = 0;
+    barrier->generation = 0;
+    barrier->sleepers = 0;
+}
+
+void worker_barrier_wait(worker_barrier_t *barrier) {
+    const unsigned int gen =
+        __atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE);
+    if (__atomic_add_fetch(&barrier->arrived, 1, __ATOMIC_ACQ_REL)
+            == barrier->count) {
+        __atomic_store_n(&barrier->arrived, 0, __ATOMIC_RELAXED);
+        bump(&barrier->generation, &barrier->sleepers);
+    } else {
+        wait_change(&barrier->generation, gen, &barrier->sleepers);
+    }
+}
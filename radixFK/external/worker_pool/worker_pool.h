@@ -0,0 +1,57 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+/*
+ * Persistent fork-join worker pool shared by every stage of the join.
+ *
+ * worker_pool_init(n) starts n - 1 threads and pins every worker to a CPU the
+ * process may run on, spreading them over the NUMA nodes in blocks of
+ * consecutive ids; the calling thread is worker 0. Every worker belongs
+ * to a team of consecutive workers [self, self + team): the main thread starts
+ * with the whole pool, and a job handed to a worker brings its own sub-team,
+ * so nested calls fan out over disjoint workers and never wait on each other.
+ *
+ * Idle workers and waiting callers spin briefly and then sleep on a futex.
+ * Without worker_pool_init every call runs serially on the calling thread.
+ */
+
+typedef struct worker_barrier {
+    unsigned int count;
+    unsigned int arrived;
+    unsigned int generation;
+    unsigned int sleepers;
+} worker_barrier_t;
+
+void worker_pool_init(int num_workers);
+void worker_pool_shutdown(void);
+
+/* number of workers in the pool, 1 if it was never started */
+int worker_pool_size(void);
+/* number of workers in the calling thread's team (itself included) */
+int worker_pool_team_size(void);
+
+/* number of NUMA nodes the workers are spread over, 1 if unknown */
+int worker_pool_num_nodes(void);
+/* node of the calling worker, 0 .. worker_pool_num_nodes() - 1 */
+int worker_pool_node(void);
+
+/*
+ * Runs fn(arg, i) for every i in [0, count) and returns once all calls are
+ * done. min(count, team) workers of the caller's team take part, the caller
+ * being one of them; worker k handles i = k, k + width, ... in order. When
+ * count is smaller than the team, each call gets a share of it as sub-team.
+ */
+void worker_pool_run(int count, void (*fn)(void *arg, int i), void *arg);
+
+/*
+ * Runs fn_a(arg_a) on the first width_a workers of the caller's team and,
+ * concurrently, fn_b(arg_b) on the rest. Serial if the team has one worker.
+ */
+void worker_pool_invoke2(int width_a, void (*fn_a)(void *), void *arg_a,
+                         void (*fn_b)(void *), void *arg_b);
+
+/* spin-then-futex barrier for count workers of one job */
+void worker_barrier_init(worker_barrier_t *barrier, unsigned int count);
+void worker_barrier_wait(worker_barrier_t *barrier);
+
+#endif /* WORKER_POOL_H */
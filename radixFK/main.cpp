@@ -3,27 +3,42 @@
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <sys/resource.h>
 
 #include "backfill_dummies.h"
+#include "binary_tables.h"
 #include "carry_forward.h"
 #include "generate_hash_R.h"
 #include "inputs.h"
+#include "output_sink.h"
 #include "parallel_counts.h"
+#include "parallel_for.h"
 #include "prefix_sum_expand.h"
 #include "replace_dummies.h"
 #include "result_indices.h"
+#include "result_writer.h"
 #include "slice_utils.h"
 
 extern "C" {
 #include "bitonic.h"
+#include "join_arena.h"
+#include "numa_shuffle.h"
 #include "radix_join_counts.h"
 #include "radix_join_idx.h"
+#include "radix_scatter.h"
+#include "radix_tuner.h"
+#include "scratch.h"
 #include "threading.h"
 }
 
 // #define PRE_SORTED // use this if your tables are already sorted
+// (binary inputs carry this as BINARY_TABLE_SORTED, see binary_tables.h)
+
+// #define STREAM_OUTPUT // write join.txt from inside carry-forward, slice by
+// slice as each one becomes final; the output time then counts as join time
 
 // Global timers
 std::chrono::high_resolution_clock::time_point tStart, tEnd;
@@ -63,9 +78,114 @@ findMaxBins(double n, double target_p = 0.001, double eps = 1e-6) {
   return {prevPow2(static_cast<std::uint32_t>(std::ceil(m))), p};
 }
 
+// --numa=<strategy>: NUMA shuffling strategy of the pass-1 scatter
+inline bool parseNumaStrategy(const std::string &arg) {
+  const std::string prefix = "--numa=";
+  if (arg.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  const std::string v = arg.substr(prefix.size());
+  if (v == "ring")
+    numa_set_shuffle_strategy(RING);
+  else if (v == "next")
+    numa_set_shuffle_strategy(NEXT);
+  else if (v == "random")
+    numa_set_shuffle_strategy(RANDOM);
+  else
+    return false;
+  return true;
+}
+
+// --scatter=<kind>: stores of the radix partitioning scatter
+inline bool parseScatter(const std::string &arg) {
+  const std::string prefix = "--scatter=";
+  if (arg.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  const std::string v = arg.substr(prefix.size());
+  if (v == "direct")
+    radix_set_scatter(SCATTER_DIRECT);
+  else if (v == "swwc")
+    radix_set_scatter(SCATTER_SWWC);
+  else
+    return false;
+  return true;
+}
+
+// --pages=<kind>: pages of the radix partition buffers
+inline bool parsePages(const std::string &arg) {
+  const std::string prefix = "--pages=";
+  if (arg.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  const std::string v = arg.substr(prefix.size());
+  if (v == "default")
+    join_arena_set_huge_pages(false);
+  else if (v == "huge")
+    join_arena_set_huge_pages(true);
+  else
+    return false;
+  return true;
+}
+
+// --sort=<engine>: oblivious sort used for the input tables (and alignment)
+inline bool parseSortEngine(const std::string &arg) {
+  const std::string prefix = "--sort=";
+  if (arg.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  const std::string v = arg.substr(prefix.size());
+  if (v == "bitonic")
+    set_sort_engine(SORT_BITONIC);
+  else if (v == "bucket")
+    set_sort_engine(SORT_BUCKET);
+  else if (v == "shuffle")
+    set_sort_engine(SORT_SHUFFLE);
+  else if (v == "tag")
+    set_sort_engine(SORT_TAG);
+  else
+    return false;
+  return true;
+}
+
+// --radix-bits=<n|auto> and --passes=<n>: radix fan-out of the joins, by
+// default the one of the build (NUM_RADIX_BITS and NUM_PASSES)
+struct RadixConfig {
+  radix_params params = radix_default_params();
+  bool autoTune = false;
+  cache_geometry geo{};
+};
+
+inline bool parseRadix(const std::string &arg, RadixConfig &cfg) {
+  const std::string bitsPrefix = "--radix-bits=", passesPrefix = "--passes=";
+  int *field;
+  std::string v;
+  if (arg.compare(0, bitsPrefix.size(), bitsPrefix) == 0) {
+    v = arg.substr(bitsPrefix.size());
+    field = &cfg.params.bits;
+    if (v == "auto") {
+      cfg.autoTune = true;
+      return true;
+    }
+  } else if (arg.compare(0, passesPrefix.size(), passesPrefix) == 0) {
+    v = arg.substr(passesPrefix.size());
+    field = &cfg.params.passes;
+  } else {
+    return false;
+  }
+  char *end;
+  long n = std::strtol(v.c_str(), &end, 10);
+  if (v.empty() || *end != '\0' || n < 1 || n > 32)
+    return false;
+  *field = static_cast<int>(n);
+  return true;
+}
+
+// radix parameters for a join of nR with nS rows
+inline radix_params radixFor(const RadixConfig &cfg, std::uint64_t nR,
+                             std::uint64_t nS, std::uint32_t threads) {
+  return cfg.autoTune ? radix_autotune(nR, nS, threads, &cfg.geo) : cfg.params;
+}
+
 int main(int argc, char *argv[]) {
-  printf("[INFO] Set number of radix bits and passes in the top-level "
-         "CMakeLists.txt.\n");
+  printf("[INFO] Set the radix bits and passes with --radix-bits and "
+         "--passes, or --radix-bits=auto.\n");
   printf("[INFO] R: Primary Key table; S: Foreign Key table\n");
   std::uint32_t numThreads = 32;
   std::string inputPath = "../../datasets/real/imdb/imdb.txt";
@@ -74,81 +194,110 @@ int main(int argc, char *argv[]) {
     numThreads = std::max<std::uint32_t>(1, std::stoul(argv[1]));
   if (argc > 2)
     inputPath = argv[2];
-  if (argc > 3) {
-    std::cerr << "Program takes 2 arguments: number of threads and input "
-                 "filepath."
-              << std::endl;
+  SinkConfig sink;
+  RadixConfig radix;
+  for (int a = 3; a < argc; ++a) {
+    if (!parseSink(argv[a], sink) && !parseNumaStrategy(argv[a]) &&
+        !parseSortEngine(argv[a]) && !parseRadix(argv[a], radix) &&
+        !parseScatter(argv[a]) && !parsePages(argv[a])) {
+      std::cerr << "Program takes 2 arguments: number of threads and input "
+                   "filepath, optionally followed by "
+                   "--sink=text|binary|count|checksum|sum:R|sum:S, "
+                   "--numa=ring|next|random, --sort=bitonic|bucket|shuffle|tag,"
+                   " --radix-bits=<n>|auto, --passes=<n>, "
+                   "--scatter=direct|swwc and --pages=default|huge."
+                << std::endl;
+      return 1;
+    }
+  }
+  if (radix.autoTune) {
+    cache_geometry_detect(&radix.geo);
+  } else if (!radix_params_valid(&radix.params)) {
+    std::cerr << "Unsupported radix configuration: " << radix.params.bits
+              << " bits in " << radix.params.passes << " pass(es); at most "
+              << RADIX_MAX_PASSES << " passes of at most "
+              << RADIX_MAX_PASS_BITS << " bits each and " << RADIX_MAX_BITS
+              << " bits in total." << std::endl;
     return 1;
   }
   printf("Input: %s\n", inputPath.c_str());
   printf("Threads: %u\n", numThreads);
 
-  std::vector<Record> t0, t1;
-  if (!load_two_tables(inputPath, t0, t1))
-    return 1;
+  worker_pool_init(numThreads);
+  std::atexit(worker_pool_shutdown);
+  printf("NUMA nodes: %d\n", worker_pool_num_nodes());
+  printf("Sort engine: %s\n", sort_engine_name(get_sort_engine()));
+
+  bool preSorted = false;
+#ifdef PRE_SORTED
+  preSorted = true;
+#endif
 
   table_t R, S;
-  R.tuples = new row_t[t0.size()];
-  std::memcpy(R.tuples, t0.data(), t0.size() * sizeof(Record));
-  R.num_tuples = static_cast<uint32_t>(t0.size());
+  if (is_binary_tables(inputPath)) {
+    std::uint32_t flags;
+    if (!map_two_tables(inputPath, R, S, flags, numThreads))
+      return 1;
+    preSorted |= (flags & BINARY_TABLE_SORTED) != 0;
+  } else if (!load_two_tables(inputPath, R, S, numThreads)) {
+    return 1;
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("Peak RSS after load: %.1f MiB\n", usage.ru_maxrss / 1024.0);
   for (int i = 0; i < R.num_tuples; i++) {
     R.tuples[i].cntSelf = 1;
   }
 
-  S.tuples = new row_t[t1.size()];
-  std::memcpy(S.tuples, t1.data(), t1.size() * sizeof(Record));
-  S.num_tuples = static_cast<uint32_t>(t1.size());
-
-  t0.clear();
-  t0.shrink_to_fit();
-  t1.clear();
-  t1.shrink_to_fit();
-
   auto slices_S_numThreads = buildSlices(S.num_tuples, numThreads);
   auto slices_R_numThreads = buildSlices(R.num_tuples, numThreads);
 
   std::vector<int> lastLen(slices_S_numThreads.size()),
       mergeVal(slices_S_numThreads.size() - 1);
 
-  printf("\nRadix bits: %u, Passes: %u\n", NUM_RADIX_BITS, NUM_PASSES);
+  if (radix.autoTune)
+    printf("\nCache: L1 %zu KiB (%u-way, %zu B lines), L2 %zu KiB\n",
+           radix.geo.l1_size >> 10, radix.geo.l1_assoc, radix.geo.line_size,
+           radix.geo.l2_size >> 10);
+  const radix_params radixCounts =
+      radixFor(radix, R.num_tuples, S.num_tuples, numThreads);
+  printf("\nRadix bits: %d, Passes: %d%s\n", radixCounts.bits,
+         radixCounts.passes, radix.autoTune ? " (auto)" : "");
   std::uint32_t bins;
 
   double p;
   if (R.num_tuples <= S.num_tuples) {
-    std::tie(bins, p) = findMaxBins(R.num_tuples / std::pow(2, NUM_RADIX_BITS));
+    std::tie(bins, p) =
+        findMaxBins(R.num_tuples / std::pow(2, radixCounts.bits));
   } else {
-    std::tie(bins, p) = findMaxBins(S.num_tuples / std::pow(2, NUM_RADIX_BITS));
+    std::tie(bins, p) =
+        findMaxBins(S.num_tuples / std::pow(2, radixCounts.bits));
   }
   printf("(EXCHANGE)   Bins: %u, Lemma 1 p: %.4f\n", bins, p);
 
-#ifndef PRE_SORTED
-  extern size_t total_num_threads;
-  total_num_threads = numThreads;
-  thread_system_init();
-
-  std::vector<std::thread> pool;
-  for (size_t i = 1; i < numThreads; ++i)
-    pool.emplace_back(thread_start_work);
-
-  tStart = std::chrono::high_resolution_clock::now();
-
-  std::chrono::high_resolution_clock::time_point t1Start, t1End;
-  t1Start = std::chrono::high_resolution_clock::now();
-
-  bitonic_sort_(S.tuples, true, 0, S.num_tuples, numThreads, false);
-  t1End = std::chrono::high_resolution_clock::now();
-  double t1Sec =
-      std::chrono::duration_cast<std::chrono::duration<double>>(t1End - t1Start)
-          .count();
-  printf("Bitonic sort R completed in %f s\n", t1Sec);
-
-  thread_release_all();
-  for (auto &t : pool)
-    t.join();
-  thread_system_cleanup();
-#else
-  tStart = std::chrono::high_resolution_clock::now();
-#endif
+  if (!preSorted) {
+    tStart = std::chrono::high_resolution_clock::now();
+
+    std::chrono::high_resolution_clock::time_point t1Start, t1End;
+    t1Start = std::chrono::high_resolution_clock::now();
+
+    thread_run_on_pool(
+        [](void *arg, size_t sortThreads) {
+          table_t *S = static_cast<table_t *>(arg);
+          bitonic_sorter sorter;
+          bitonic_sorter_init(&sorter, S->tuples, sortThreads, false);
+          bitonic_sorter_sort(&sorter, true, 0, S->num_tuples);
+        },
+        &S, numThreads);
+    t1End = std::chrono::high_resolution_clock::now();
+    double t1Sec = std::chrono::duration_cast<std::chrono::duration<double>>(
+                       t1End - t1Start)
+                       .count();
+    printf("Sort R (%s) completed in %f s\n",
+           sort_engine_name(get_sort_engine()), t1Sec);
+  } else {
+    tStart = std::chrono::high_resolution_clock::now();
+  }
 
   std::chrono::high_resolution_clock::time_point t2Start, t2End;
   t2Start = std::chrono::high_resolution_clock::now();
@@ -169,9 +318,9 @@ int main(int argc, char *argv[]) {
   replaceWithDummiesParallel(S, slices_S_numThreads);
 
   if (S.num_tuples >= R.num_tuples) {
-    RHO(&R, &S, numThreads, false, bins);
+    RHO(&R, &S, numThreads, false, bins, &radixCounts);
   } else {
-    RHO(&S, &R, numThreads, true, bins);
+    RHO(&S, &R, numThreads, true, bins, &radixCounts);
   }
 
   t3End = std::chrono::high_resolution_clock::now();
@@ -190,6 +339,17 @@ int main(int argc, char *argv[]) {
             .count();
     printf("Backfilling dummies completed in %f s\n", t4Sec);
 
+  if (isAggregateSink(sink)) {
+    join_result_t res = aggregateFromS(S, slices_S_numThreads, sink);
+    tEnd = std::chrono::high_resolution_clock::now();
+    double sec = std::chrono::duration_cast<std::chrono::duration<double>>(
+                     tEnd - tStart)
+                     .count();
+    printf("\nJoin completed in %f s\n", sec);
+    reportAggregate(sink, res);
+    return 0;
+  }
+
 
     std::chrono::high_resolution_clock::time_point t5Start, t5End;
   t5Start = std::chrono::high_resolution_clock::now();
@@ -222,29 +382,53 @@ int main(int argc, char *argv[]) {
 
   table_t expanded{};
   expanded.tuples = static_cast<row_t *>(aligned_alloc(32, bytes));
-  std::memset(expanded.tuples, 0, bytes);
+  clear_table_parallel(expanded, slices_m);
   expanded.num_tuples = m;
 
-  std::tie(bins, p) = findMaxBins(m / std::pow(2, NUM_RADIX_BITS));
-  RHO_idx(&idxTable, &S, numThreads, &expanded, bins);
+  const radix_params radixIdx = radixFor(radix, m, S.num_tuples, numThreads);
+  if (radix.autoTune)
+    printf("Radix bits: %d, Passes: %d (auto, index join)\n", radixIdx.bits,
+           radixIdx.passes);
+  std::tie(bins, p) = findMaxBins(m / std::pow(2, radixIdx.bits));
+  RHO_idx(&idxTable, &S, numThreads, &expanded, bins, &radixIdx);
+  scratch_release();
+  join_arena_release();
 
   
+#ifdef STREAM_OUTPUT
+  const bool binary = sink.kind == SinkKind::Binary;
+  const char *outPath = binary ? "join.bin" : "join.txt";
+  const JoinResultHeader hdr = joinResultHeader(m);
+  ResultWriter writer(outPath, slices_m.size(), binary ? sizeof(hdr) : 0);
+  if (!writer.ok())
+    return 1;
+  if (binary)
+    writer.writeHeader(&hdr, sizeof(hdr));
+  carryForwardParallel(
+      expanded, slices_m, [&](std::size_t t, const Slice &sl) {
+        if (binary)
+          writer.writeSlice(t, sl, ExpandedBinaryFormat{expanded.tuples});
+        else
+          writer.writeSlice(t, sl, ExpandedRowFormat{expanded.tuples});
+      });
+  if (!writer.finish())
+    return 1;
+#else
   carryForwardParallel(expanded, slices_m);
+#endif
 
   printf("(DISTRIBUTE) Bins: %u, Lemma 1 p: %.4f\n", bins, p);
   double sec =
       std::chrono::duration_cast<std::chrono::duration<double>>(tEnd - tStart)
           .count();
   printf("\nJoin completed in %f s\n", sec);
-  {
-    std::ofstream outER("join.txt");
-    for (int i = 0; i < expanded.num_tuples; i++) {
-      outER << expanded.tuples[i].key << ' ' << expanded.tuples[i].payPrimary
-            << ' ' << expanded.tuples[i].key << ' '
-            << expanded.tuples[i].paySelf << '\n';
-    }
-  }
-  printf("Join result rows: %ld (written to join.txt)\n", expanded.num_tuples);
+#ifndef STREAM_OUTPUT
+  const char *outPath = writeExpanded(sink, expanded, slices_m);
+  if (!outPath)
+    return 1;
+#endif
+  printf("Join result rows: %ld (written to %s)\n", expanded.num_tuples,
+         outPath);
 
   return 0;
 }
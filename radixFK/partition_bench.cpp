@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "data-types.h"
+
+extern "C" {
+#include "prj_params.h"
+#include "radix_scatter.h"
+#include "worker_pool.h"
+}
+
+// Times the histogram and the scatter of one radix partitioning pass, direct
+// stores against software write-combining with non-temporal stores, for
+// growing fan-outs.
+// Every thread scatters its own share of the rows into its own buffer, with
+// SMALL_PADDING_TUPLES between the partitions as in the joins.
+
+struct ThreadShare {
+  const row_t *rel;
+  row_t *out;
+  std::uint64_t num;
+  std::vector<std::uint16_t> ids;   // partition of every row
+  std::vector<std::uint32_t> hist;
+  std::vector<std::uint32_t> start; // first slot of every partition
+  std::vector<std::uint32_t> dst;
+};
+
+struct BenchRun {
+  std::vector<ThreadShare> *shares;
+  std::uint32_t fanOut;
+  int step; // 0: histogram, 1: direct scatter, 2: swwc scatter
+};
+
+static void runShare(void *arg, int t) {
+  BenchRun *r = static_cast<BenchRun *>(arg);
+  ThreadShare &s = (*r->shares)[t];
+  if (r->step == 0)
+    radix_histogram(s.rel, s.num, r->fanOut - 1, 0, s.ids.data(),
+                    s.hist.data(), r->fanOut);
+  else if (r->step == 1)
+    radix_scatter_direct(s.out, s.rel, s.ids.data(), s.num, s.dst.data());
+  else
+    radix_scatter_swwc(s.out, s.rel, s.ids.data(), s.num, s.dst.data(),
+                       r->fanOut);
+}
+
+// best of three runs, in seconds
+static double timeStep(std::vector<ThreadShare> &shares, std::uint32_t fanOut,
+                       int step) {
+  BenchRun run{&shares, fanOut, step};
+  double best = 1e30;
+  for (int rep = 0; rep < 3; ++rep) {
+    for (ThreadShare &s : shares) {
+      s.hist.assign(fanOut, 0);
+      s.dst = s.start;
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    worker_pool_run(static_cast<int>(shares.size()), runShare, &run);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 5) {
+    std::cerr << "Usage: PartitionBench [num_threads] [log2_n] [min_bits] "
+                 "[max_bits]"
+              << std::endl;
+    return 1;
+  }
+  unsigned numThreads = std::max(1u, std::thread::hardware_concurrency());
+  unsigned logN = 24, minBits = 4, maxBits = 14;
+  if (argc > 1)
+    numThreads = std::max<unsigned>(1, std::stoul(argv[1]));
+  if (argc > 2)
+    logN = std::min<unsigned>(30, std::stoul(argv[2]));
+  if (argc > 3)
+    minBits = std::max<unsigned>(1, std::stoul(argv[3]));
+  if (argc > 4)
+    maxBits = std::min<unsigned>(16, std::stoul(argv[4]));
+
+  worker_pool_init(numThreads);
+  std::atexit(worker_pool_shutdown);
+
+  const std::uint64_t n = std::uint64_t(1) << logN;
+  row_t *rel = static_cast<row_t *>(std::aligned_alloc(64, n * sizeof(row_t)));
+  std::mt19937_64 rng(42);
+  for (std::uint64_t i = 0; i < n; ++i) {
+    rel[i] = row_t{};
+    rel[i].key = static_cast<std::uint32_t>(rng());
+    rel[i].hashKey = rel[i].key;
+    rel[i].idx = static_cast<std::uint32_t>(i);
+  }
+
+  printf("Threads: %u, rows: %" PRIu64 "\n", numThreads, n);
+  printf("%6s %8s %14s %14s %14s %9s\n", "bits", "fan-out", "hist [M/s]",
+         "direct [M/s]", "swwc [M/s]", "swwc");
+  bool allOk = true;
+  for (unsigned bits = minBits; bits <= maxBits; ++bits) {
+    const std::uint32_t fanOut = 1u << bits;
+    const std::uint64_t per = n / numThreads;
+    const std::size_t outTuples = per + n % numThreads +
+                                  std::size_t(fanOut) * SMALL_PADDING_TUPLES;
+    std::vector<ThreadShare> shares(numThreads);
+    for (unsigned t = 0; t < numThreads; ++t) {
+      shares[t].rel = rel + t * per;
+      shares[t].num = t + 1 == numThreads ? n - t * per : per;
+      shares[t].ids.resize(shares[t].num);
+    }
+    const double tHist = timeStep(shares, fanOut, 0);
+
+    bool ok = true;
+    std::vector<row_t *> outDirect(numThreads), outSwwc(numThreads);
+    for (unsigned t = 0; t < numThreads; ++t) {
+      ThreadShare &s = shares[t];
+      std::vector<std::uint32_t> hist(fanOut);
+      for (std::uint64_t i = 0; i < s.num; ++i) {
+        const std::uint32_t p = s.rel[i].hashKey & (fanOut - 1);
+        ok &= s.ids[i] == p;
+        hist[p]++;
+      }
+      ok &= hist == s.hist;
+      s.start.resize(fanOut);
+      std::uint32_t offset = 0;
+      for (std::uint32_t p = 0; p < fanOut; ++p) {
+        s.start[p] = offset + p * SMALL_PADDING_TUPLES;
+        offset += hist[p];
+      }
+      const std::size_t bytes = outTuples * sizeof(row_t);
+      outDirect[t] = static_cast<row_t *>(std::aligned_alloc(64, bytes));
+      outSwwc[t] = static_cast<row_t *>(std::aligned_alloc(64, bytes));
+      std::memset(outDirect[t], 0, bytes);
+      std::memset(outSwwc[t], 0, bytes);
+    }
+
+    for (unsigned t = 0; t < numThreads; ++t)
+      shares[t].out = outDirect[t];
+    const double tDirect = timeStep(shares, fanOut, 1);
+    for (unsigned t = 0; t < numThreads; ++t)
+      shares[t].out = outSwwc[t];
+    const double tSwwc = timeStep(shares, fanOut, 2);
+
+    for (unsigned t = 0; t < numThreads; ++t) {
+      ok &= std::memcmp(outDirect[t], outSwwc[t],
+                        outTuples * sizeof(row_t)) == 0;
+      std::free(outDirect[t]);
+      std::free(outSwwc[t]);
+    }
+    printf("%6u %8u %14.1f %14.1f %14.1f %8.2fx%s\n", bits, fanOut,
+           n / tHist / 1e6, n / tDirect / 1e6, n / tSwwc / 1e6,
+           tDirect / tSwwc, ok ? "" : "  MISMATCH");
+    allOk &= ok;
+  }
+  std::free(rel);
+  return allOk ? 0 : 1;
+}
@@ -2,10 +2,10 @@
 #include <cstdint>
 #include <cstring>
 #include <openssl/aes.h>
-#include <thread>
 #include <vector>
 
 #include "data-types.h"
+#include "parallel_for.h"
 #include "slice_utils.h"
 #include "triple32.h"
 
@@ -18,30 +18,23 @@ inline uint64_t prefixSumExpandParallel(table_t &tbl,
   const size_t P = slices.size();
 
   std::vector<uint32_t> sliceSum(P, 0);
-  std::vector<std::thread> pool;
-  pool.reserve(P);
+  parallelFor(P, [&](size_t t) {
+    const Slice sl = slices[t];
+    uint32_t run = 0;
 
-  for (size_t t = 0; t < P; ++t) {
-    pool.emplace_back([&, t] {
-      const Slice sl = slices[t];
-      uint32_t run = 0;
-
-      for (uint32_t i = sl.begin; i < sl.end; ++i) {
-        row_t &rec = tbl.tuples[i];
-        uint32_t mask = -(rec.payPrimary[0] != 0);
+    for (uint32_t i = sl.begin; i < sl.end; ++i) {
+      row_t &rec = tbl.tuples[i];
+      uint32_t mask = -(rec.payPrimary[0] != 0);
 
-        uint32_t dummyVal = triple32(i);
-        uint32_t idx0 = (mask & run) | (~mask & dummyVal);
+      uint32_t dummyVal = triple32(i);
+      uint32_t idx0 = (mask & run) | (~mask & dummyVal);
 
-        rec.idx = idx0;
-        rec.hashKey = dummyVal;
-        run += (-mask);
-      }
-      sliceSum[t] = run;
-    });
-  }
-  for (auto &th : pool)
-    th.join();
+      rec.idx = idx0;
+      rec.hashKey = dummyVal;
+      run += (-mask);
+    }
+    sliceSum[t] = run;
+  });
 
   std::vector<uint32_t> offset(P);
   uint32_t running = 0;
@@ -51,27 +44,21 @@ inline uint64_t prefixSumExpandParallel(table_t &tbl,
   }
   const uint32_t m = running;
 
-  pool.clear();
-  pool.reserve(P);
-  for (size_t t = 0; t < P; ++t) {
-    pool.emplace_back([&, t] {
-      const Slice sl = slices[t];
-      uint32_t off32 = offset[t];
+  parallelFor(P, [&](size_t t) {
+    const Slice sl = slices[t];
+    uint32_t off32 = offset[t];
 
-      for (size_t i = sl.begin; i < sl.end; ++i) {
-        row_t &rec = tbl.tuples[i];
-        uint32_t mask = -(rec.payPrimary[0] != 0);
+    for (size_t i = sl.begin; i < sl.end; ++i) {
+      row_t &rec = tbl.tuples[i];
+      uint32_t mask = -(rec.payPrimary[0] != 0);
 
-        uint32_t newIdx = rec.idx + (mask & off32);
-        rec.idx = newIdx;
+      uint32_t newIdx = rec.idx + (mask & off32);
+      rec.idx = newIdx;
 
-        uint32_t newHash = triple32(newIdx);
-        rec.hashKey = newHash;
-      }
-    });
-  }
-  for (auto &th : pool)
-    th.join();
+      uint32_t newHash = triple32(newIdx);
+      rec.hashKey = newHash;
+    }
+  });
 
   return m;
 }
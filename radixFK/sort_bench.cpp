@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "data-types.h"
+
+extern "C" {
+#include "bitonic.h"
+#include "threading.h"
+#include "worker_pool.h"
+}
+
+// Times the oblivious sort engines on random rows of growing size, to find
+// where the O(n log n) bucket sort overtakes the O(n log^2 n) bitonic sort on
+// this machine, and how much shuffle-then-sort and the tag sort save. Keys
+// repeat (about n / 4 distinct values), as in the joins.
+
+struct BenchRun {
+  row_t *rows;
+  int n;
+  enum sort_engine engine;
+};
+
+// sorted by key, and still holding every input row (idx) exactly once
+static bool sortedByKey(const std::vector<row_t> &rows) {
+  std::vector<bool> seen(rows.size());
+  for (std::size_t i = 0; i < rows.size(); ++i) {
+    if (i > 0 && rows[i].key < rows[i - 1].key)
+      return false;
+    if (rows[i].idx >= rows.size() || seen[rows[i].idx])
+      return false;
+    seen[rows[i].idx] = true;
+  }
+  return true;
+}
+
+static double timeSort(std::vector<row_t> rows, enum sort_engine engine,
+                       unsigned numThreads, bool &ok) {
+  BenchRun run{rows.data(), static_cast<int>(rows.size()), engine};
+  auto start = std::chrono::high_resolution_clock::now();
+  thread_run_on_pool(
+      [](void *arg, size_t sortThreads) {
+        BenchRun *r = static_cast<BenchRun *>(arg);
+        bitonic_sorter sorter;
+        bitonic_sorter_init(&sorter, r->rows, sortThreads, false);
+        sorter.engine = r->engine;
+        bitonic_sorter_sort(&sorter, true, 0, r->n);
+      },
+      &run, numThreads);
+  auto end = std::chrono::high_resolution_clock::now();
+  ok = sortedByKey(rows);
+  return std::chrono::duration_cast<std::chrono::duration<double>>(end - start)
+      .count();
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 4) {
+    std::cerr << "Usage: SortBench [num_threads] [max_log2_n] [min_log2_n]"
+              << std::endl;
+    return 1;
+  }
+  unsigned numThreads = std::max(1u, std::thread::hardware_concurrency());
+  unsigned maxLog = 22, minLog = 12;
+  if (argc > 1)
+    numThreads = std::max<unsigned>(1, std::stoul(argv[1]));
+  if (argc > 2)
+    maxLog = std::min<unsigned>(30, std::stoul(argv[2]));
+  if (argc > 3)
+    minLog = std::stoul(argv[3]);
+
+  worker_pool_init(numThreads);
+  std::atexit(worker_pool_shutdown);
+
+  printf("Threads: %u\n", numThreads);
+  printf("%10s %12s %12s %12s %12s %9s %9s %9s\n", "n", "bitonic [s]",
+         "bucket [s]", "shuffle [s]", "tag [s]", "bucket", "shuffle", "tag");
+  std::mt19937_64 rng(42);
+  bool allOk = true;
+  for (unsigned lg = minLog; lg <= maxLog; ++lg) {
+    const std::size_t n = std::size_t(1) << lg;
+    std::vector<row_t> rows(n);
+    std::uniform_int_distribution<std::uint32_t> key(0, n / 4);
+    for (std::size_t i = 0; i < n; ++i) {
+      rows[i] = row_t{};
+      rows[i].key = key(rng);
+      rows[i].idx = static_cast<std::uint32_t>(i);
+    }
+
+    bool okBitonic, okBucket, okShuffle, okTag;
+    double tBitonic = timeSort(rows, SORT_BITONIC, numThreads, okBitonic);
+    double tBucket = timeSort(rows, SORT_BUCKET, numThreads, okBucket);
+    double tShuffle = timeSort(rows, SORT_SHUFFLE, numThreads, okShuffle);
+    double tTag = timeSort(rows, SORT_TAG, numThreads, okTag);
+    const bool ok = okBitonic && okBucket && okShuffle && okTag;
+    printf("%10zu %12.4f %12.4f %12.4f %12.4f %8.2fx %8.2fx %8.2fx%s\n", n,
+           tBitonic, tBucket, tShuffle, tTag, tBitonic / tBucket,
+           tBitonic / tShuffle, tBitonic / tTag, ok ? "" : "  NOT SORTED");
+    allOk &= ok;
+  }
+  return allOk ? 0 : 1;
+}
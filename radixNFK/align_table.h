@@ -1,9 +1,9 @@
 #pragma once
 #include "inputs.h"
+#include "parallel_for.h"
 #include "slice_utils.h"
 #include <chrono>
 #include <cstdint>
-#include <thread>
 #include <vector>
 
 // Global timer defined in main.cpp
@@ -20,32 +20,25 @@ inline void within_key(const table_t &tbl, const std::vector<Slice> &slices,
   W.resize(N);
   const int P = static_cast<int>(slices.size());
 
-  std::vector<std::thread> pool;
-  pool.reserve(P);
-
   std::vector<std::uint64_t> sliceFirstKey(P);
   std::vector<int> sliceOffsets(P);
 
-  for (int t = 0; t < P; ++t)
-    pool.emplace_back([&, t] {
-      const Slice sl = slices[t];
-      std::uint64_t prev = tbl.tuples[sl.begin].key;
-      sliceFirstKey[t] = prev;
-      int idx = 0;
-      W[sl.begin] = idx;
-
-      for (int i = sl.begin + 1; i < sl.end; ++i) {
-        std::uint64_t cur = tbl.tuples[i].key;
-        int same = -(cur == prev);
-        int diff = ~same;
-        idx = (same & (idx + 1)) | (diff & 0);
-        prev = (same & prev) | (diff & cur);
-        W[i] = idx;
-      }
-    });
-  for (auto &th : pool)
-    th.join();
-  pool.clear();
+  parallelFor(P, [&](int t) {
+    const Slice sl = slices[t];
+    std::uint64_t prev = tbl.tuples[sl.begin].key;
+    sliceFirstKey[t] = prev;
+    int idx = 0;
+    W[sl.begin] = idx;
+
+    for (int i = sl.begin + 1; i < sl.end; ++i) {
+      std::uint64_t cur = tbl.tuples[i].key;
+      int same = -(cur == prev);
+      int diff = ~same;
+      idx = (same & (idx + 1)) | (diff & 0);
+      prev = (same & prev) | (diff & cur);
+      W[i] = idx;
+    }
+  });
 
   sliceOffsets[0] = 0;
   for (int t = 1; t < P; ++t) {
@@ -60,19 +53,16 @@ inline void within_key(const table_t &tbl, const std::vector<Slice> &slices,
     sliceOffsets[t] = spill & (offPrev + tailLen);
   }
 
-  for (int t = 0; t < P; ++t)
-    pool.emplace_back([&, t] {
-      const Slice sl = slices[t];
-      int off = sliceOffsets[t];
-      auto firstKey = sliceFirstKey[t];
-
-      for (int i = sl.begin; i < sl.end; ++i) {
-        int mask = -(tbl.tuples[i].key == firstKey);
-        W[i] += mask & off;
-      }
-    });
-  for (auto &th : pool)
-    th.join();
+  parallelFor(P, [&](int t) {
+    const Slice sl = slices[t];
+    int off = sliceOffsets[t];
+    auto firstKey = sliceFirstKey[t];
+
+    for (int i = sl.begin; i < sl.end; ++i) {
+      int mask = -(tbl.tuples[i].key == firstKey);
+      W[i] += mask & off;
+    }
+  });
 }
 
 inline void alignTableParallel(table_t &S, const std::vector<Slice> &slices,
@@ -84,24 +74,18 @@ inline void alignTableParallel(table_t &S, const std::vector<Slice> &slices,
   std::vector<int> W;
   within_key(S, slices, W);
 
-  {
-    std::vector<std::thread> pool;
-    pool.reserve(slices.size());
-    for (const Slice &sl : slices)
-      pool.emplace_back([&, sl] {
-        for (int i = sl.begin; i < sl.end; ++i) {
-          int q = W[i];
-          int a2 = S.tuples[i].cntExpand;
-          int a1 = S.tuples[i].cntSelf;
-          int row = q / a2;
-          int col = q - row * a2;
-          int ii = row + col * a1;
-          S.tuples[i].idx = ii;
-        }
-      });
-    for (auto &th : pool)
-      th.join();
-  }
+  parallelFor(slices.size(), [&](std::size_t t) {
+    const Slice sl = slices[t];
+    for (int i = sl.begin; i < sl.end; ++i) {
+      int q = W[i];
+      int a2 = S.tuples[i].cntExpand;
+      int a1 = S.tuples[i].cntSelf;
+      int row = q / a2;
+      int col = q - row * a2;
+      int ii = row + col * a1;
+      S.tuples[i].idx = ii;
+    }
+  });
 
   struct KeyIdxLess {
     bool operator()(const Record &a, const Record &b) const {
@@ -109,22 +93,19 @@ inline void alignTableParallel(table_t &S, const std::vector<Slice> &slices,
     }
   };
 
-  thread_system_init();
-  std::vector<std::thread> pool;
-  for (size_t i = 1; i < numThreads; ++i)
-    pool.emplace_back(thread_start_work);
-
-  bitonic_sort_(reinterpret_cast<elem_t *>(S.tuples), true, 0, N, numThreads,
-                true);
-
-  auto end = std::chrono::high_resolution_clock::now();
-  double sec =
-      std::chrono::duration_cast<std::chrono::duration<double>>(end - tStart)
-          .count();
-  printf("\nJoin completed in %f s\n", sec);
-  thread_release_all();
-  for (auto &t : pool)
-    t.join();
-
-  thread_system_cleanup();
+  thread_run_on_pool(
+      [](void *arg, size_t sortThreads) {
+        table_t *S = static_cast<table_t *>(arg);
+        bitonic_sorter sorter;
+        bitonic_sorter_init(&sorter, reinterpret_cast<elem_t *>(S->tuples),
+                            sortThreads, true);
+        bitonic_sorter_sort(&sorter, true, 0, S->num_tuples);
+
+        auto end = std::chrono::high_resolution_clock::now();
+        double sec = std::chrono::duration_cast<std::chrono::duration<double>>(
+                         end - tStart)
+                         .count();
+        printf("\nJoin completed in %f s\n", sec);
+      },
+      &S, numThreads);
 }
@@ -2,8 +2,12 @@
 #include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <threads.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #include <liboblivious/algorithms.h>
 #include <liboblivious/primitives.h>
 #include "elem_t.h"
@@ -12,23 +16,31 @@
 //#include "enclave/mpi_tls.h"
 // #include "enclave/parallel_enc.h"
 #include "threading.h"
+#include "bucket_sort.h"
+#include "sample_sort.h"
+#include "tag_sort.h"
 
 #define SWAP_CHUNK_SIZE 4096
 
-static bool dimension2D;
-static elem_t *arr;
+/* single-threaded sorts and merges of at most this many rows run as a
+   precomputed comparator network on rows loaded into AVX2 registers */
+#define BITONIC_BASE_ROWS 16
 
-bool compare2D(elem_t* a, elem_t* b) {
+/* ranges of at most this many rows are sorted and merged by one thread */
+#ifndef BITONIC_L2_BYTES
+#define BITONIC_L2_BYTES (512 * 1024)
+#endif
+#define BITONIC_BLOCK_ROWS ((int) (BITONIC_L2_BYTES / 2 / sizeof(elem_t)))
+
+bool compare2D(const struct bitonic_sorter *sorter, elem_t* a, elem_t* b) {
     bool c;
-    c = (a->key < b->key) || (dimension2D && (a->key == b->key) && (a->idx < b->idx));
+    c = (a->key < b->key) || (sorter->dimension2D && (a->key == b->key) && (a->idx < b->idx));
     // c = (a->key < b->key) || (dimension2D && (a->key == b->key) && (a->j_order < b->j_order));
     return c;
 }
 
-bool compare2D_(int a, int b) {
-    bool c;
-    c = (arr[a].key < arr[b].key) || (dimension2D && (arr[a].key == arr[b].key) && (arr[a].idx < arr[b].idx));
-    return c;
+bool compare2D_(const struct bitonic_sorter *sorter, int a, int b) {
+    return compare2D(sorter, sorter->arr + a, sorter->arr + b);
 }
 
 inline int prev_pow_two(int x) {
@@ -37,12 +49,162 @@ inline int prev_pow_two(int x) {
     return y >>= 1;
 }
 
-void bitonic_compare(bool ascend, int i, int j) {
-    bool condition = !(compare2D_(i, j) == ascend);
+#ifdef __AVX2__
+_Static_assert(sizeof(elem_t) == sizeof(__m256i), "rows must fill one ymm register");
+
+#define IDX_LANE (offsetof(elem_t, idx) / sizeof(uint32_t))
+
+/* Compare-exchange of two rows held in registers: afterwards *a precedes *b
+   in the requested order. Both rows are always rewritten and the decision
+   is a blend mask, so there is no data-dependent branch or access. */
+static inline void cmpx_rows(__m256i *a, __m256i *b, bool ascend, bool d2) {
+    const __m256i idx_lane = _mm256_set1_epi32(IDX_LANE);
+    uint32_t ka = (uint32_t) _mm256_cvtsi256_si32(*a);
+    uint32_t kb = (uint32_t) _mm256_cvtsi256_si32(*b);
+    uint32_t ia = (uint32_t) _mm256_cvtsi256_si32(_mm256_permutevar8x32_epi32(*a, idx_lane));
+    uint32_t ib = (uint32_t) _mm256_cvtsi256_si32(_mm256_permutevar8x32_epi32(*b, idx_lane));
+    bool less = (ka < kb) | (d2 & (ka == kb) & (ia < ib));
+    __m256i mask = _mm256_set1_epi64x(-(long long) (less ^ ascend));
+    __m256i lo = _mm256_blendv_epi8(*a, *b, mask);
+    __m256i hi = _mm256_blendv_epi8(*b, *a, mask);
+    *a = lo;
+    *b = hi;
+}
+
+void bitonic_compare(const struct bitonic_sorter *sorter, bool ascend, int i, int j) {
+    __m256i *pa = (__m256i *) (sorter->arr + i);
+    __m256i *pb = (__m256i *) (sorter->arr + j);
+    __m256i a = _mm256_loadu_si256(pa);
+    __m256i b = _mm256_loadu_si256(pb);
+    cmpx_rows(&a, &b, ascend, sorter->dimension2D);
+    _mm256_storeu_si256(pa, a);
+    _mm256_storeu_si256(pb, b);
+}
+
+/* the radix-4 step on rows i, i + c, i + 2c, i + 3c, kept in registers */
+static inline void bitonic_compare4(const struct bitonic_sorter *sorter, bool ascend, int i, int c) {
+    __m256i *p = (__m256i *) (sorter->arr + i);
+    bool d2 = sorter->dimension2D;
+    __m256i r0 = _mm256_loadu_si256(p);
+    __m256i r1 = _mm256_loadu_si256(p + c);
+    __m256i r2 = _mm256_loadu_si256(p + 2 * c);
+    __m256i r3 = _mm256_loadu_si256(p + 3 * c);
+    cmpx_rows(&r0, &r2, ascend, d2);
+    cmpx_rows(&r1, &r3, ascend, d2);
+    cmpx_rows(&r0, &r1, ascend, d2);
+    cmpx_rows(&r2, &r3, ascend, d2);
+    _mm256_storeu_si256(p, r0);
+    _mm256_storeu_si256(p + c, r1);
+    _mm256_storeu_si256(p + 2 * c, r2);
+    _mm256_storeu_si256(p + 3 * c, r3);
+}
+
+/*
+ * The comparators bitonic_sort_new and bitonic_merge issue on n rows, in
+ * the same order, recorded once for every n up to BITONIC_BASE_ROWS. flip
+ * marks comparators that sort against the direction of the whole network.
+ */
+struct bitonic_cmp {
+    uint8_t i;
+    uint8_t j;
+    bool flip;
+};
+
+struct bitonic_net {
+    int len;
+    struct bitonic_cmp cmp[BITONIC_BASE_ROWS * BITONIC_BASE_ROWS];
+};
+
+static struct bitonic_net sort_nets[BITONIC_BASE_ROWS + 1];
+static struct bitonic_net merge_nets[BITONIC_BASE_ROWS + 1];
+static once_flag nets_once = ONCE_FLAG_INIT;
+
+static void net_merge(struct bitonic_net *net, bool flip, int lo, int hi) {
+    if (hi <= lo + 1) return;
+    int mid_len = prev_pow_two(hi - lo);
+    for (int i = lo; i < hi - mid_len; i++) {
+        net->cmp[net->len++] = (struct bitonic_cmp) {i, i + mid_len, flip};
+    }
+    net_merge(net, flip, lo, lo + mid_len);
+    net_merge(net, flip, lo + mid_len, hi);
+}
+
+static void net_sort(struct bitonic_net *net, bool flip, int lo, int hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (mid == lo) return;
+    net_sort(net, !flip, lo, mid);
+    net_sort(net, flip, mid, hi);
+    net_merge(net, flip, lo, hi);
+}
+
+static void build_nets(void) {
+    for (int n = 0; n <= BITONIC_BASE_ROWS; n++) {
+        net_sort(&sort_nets[n], false, 0, n);
+        net_merge(&merge_nets[n], false, 0, n);
+    }
+}
+
+/* Runs net on arr[lo, hi): the rows are loaded once, exchanged in registers
+   and stored back once. */
+static void bitonic_run_net(const struct bitonic_sorter *sorter,
+        const struct bitonic_net *net, bool ascend, int lo, int hi) {
+    __m256i v[BITONIC_BASE_ROWS];
+    __m256i *rows = (__m256i *) (sorter->arr + lo);
+    bool d2 = sorter->dimension2D;
+    int n = hi - lo;
+
+    for (int i = 0; i < n; i++) v[i] = _mm256_loadu_si256(rows + i);
+    for (int k = 0; k < net->len; k++) {
+        const struct bitonic_cmp *c = &net->cmp[k];
+        cmpx_rows(&v[c->i], &v[c->j], ascend ^ c->flip, d2);
+    }
+    for (int i = 0; i < n; i++) _mm256_storeu_si256(rows + i, v[i]);
+}
+
+static bool bitonic_base_sort(const struct bitonic_sorter *sorter, bool ascend,
+        int lo, int hi) {
+    if (hi - lo > BITONIC_BASE_ROWS) return false;
+    call_once(&nets_once, build_nets);
+    bitonic_run_net(sorter, &sort_nets[hi - lo], ascend, lo, hi);
+    return true;
+}
+
+static bool bitonic_base_merge(const struct bitonic_sorter *sorter, bool ascend,
+        int lo, int hi) {
+    if (hi - lo > BITONIC_BASE_ROWS) return false;
+    call_once(&nets_once, build_nets);
+    bitonic_run_net(sorter, &merge_nets[hi - lo], ascend, lo, hi);
+    return true;
+}
+#else
+void bitonic_compare(const struct bitonic_sorter *sorter, bool ascend, int i, int j) {
+    elem_t *arr = sorter->arr;
+    bool condition = !(compare2D_(sorter, i, j) == ascend);
     o_memswap(arr+i, arr+j, sizeof(*arr),condition);
 }
 
+static inline void bitonic_compare4(const struct bitonic_sorter *sorter, bool ascend, int i, int c) {
+    bitonic_compare(sorter, ascend, i, i + 2 * c);
+    bitonic_compare(sorter, ascend, i + c, i + 3 * c);
+    bitonic_compare(sorter, ascend, i, i + c);
+    bitonic_compare(sorter, ascend, i + 2 * c, i + 3 * c);
+}
+
+static bool bitonic_base_sort(const struct bitonic_sorter *sorter, bool ascend,
+        int lo, int hi) {
+    (void) sorter, (void) ascend, (void) lo, (void) hi;
+    return false;
+}
+
+static bool bitonic_base_merge(const struct bitonic_sorter *sorter, bool ascend,
+        int lo, int hi) {
+    (void) sorter, (void) ascend, (void) lo, (void) hi;
+    return false;
+}
+#endif
+
 struct bitonic_merge_args_1 {
+    const struct bitonic_sorter *sorter;
     bool ascend;
     int lo;
     int hi;
@@ -50,6 +212,7 @@ struct bitonic_merge_args_1 {
 };
 
 struct bitonic_merge_args_2 {
+    const struct bitonic_sorter *sorter;
     bool ascend;
     int a;
     int b;
@@ -58,110 +221,147 @@ struct bitonic_merge_args_2 {
 
 void bitonic_merge_2(void *voidargs) {
     struct bitonic_merge_args_2 *args = (struct bitonic_merge_args_2*)voidargs;
+    const struct bitonic_sorter *sorter = args->sorter;
     bool ascend = args->ascend;
     int a = args->a;
     int b = args->b;
     int c = args->c;
 
     for(int i = a; i < b; i++) {
-        bitonic_compare(ascend, i, i + c);
+        bitonic_compare(sorter, ascend, i, i + c);
     }
 
     return;
 }
 
+/* the four-row radix-4 step: two merge levels, strides 2c and c, per sweep */
+void bitonic_merge_4(void *voidargs) {
+    struct bitonic_merge_args_2 *args = (struct bitonic_merge_args_2*)voidargs;
+    const struct bitonic_sorter *sorter = args->sorter;
+    bool ascend = args->ascend;
+    int a = args->a;
+    int b = args->b;
+    int c = args->c;
+
+    for(int i = a; i < b; i++) {
+        bitonic_compare4(sorter, ascend, i, c);
+    }
+
+    return;
+}
+
+void bitonic_merge(void *voidargs);
+
+/* Merges the k ranges [bounds[p], bounds[p + 1]) independently, splitting
+   number_threads among them. */
+static void bitonic_merge_parts(const struct bitonic_sorter *sorter, bool ascend,
+        const int *bounds, int k, int number_threads) {
+    struct bitonic_merge_args_1 args[k];
+    struct thread_work work[k - 1];
+
+    for (int p = 0; p < k; p++) {
+        int share = number_threads * (p + 1) / k - number_threads * p / k;
+        args[p].sorter = sorter;
+        args[p].ascend = ascend;
+        args[p].lo = bounds[p];
+        args[p].hi = bounds[p + 1];
+        args[p].number_threads = share < 1 ? 1 : share;
+    }
+
+    if (number_threads <= 1) {
+        for (int p = 0; p < k; p++) {
+            bitonic_merge(&args[p]);
+        }
+        return;
+    }
+    for (int p = 0; p < k - 1; p++) {
+        work[p].type = THREAD_WORK_SINGLE;
+        work[p].single.func = bitonic_merge;
+        work[p].single.arg = &args[p];
+        thread_work_push(&work[p]);
+    }
+    bitonic_merge(&args[k - 1]);
+    for (int p = 0; p < k - 1; p++) {
+        thread_wait(&work[p]);
+    }
+}
+
+/*
+ * Ranges of up to BITONIC_BLOCK_ROWS rows are merged by a single thread,
+ * depth first, so every level below that size runs out of cache without
+ * synchronizing. Larger ranges are swept level by level, two levels per
+ * sweep when the range is a power of two. The comparators are those of the
+ * plain recursion; only their order among independent rows changes.
+ */
 void bitonic_merge(void *voidargs) {
     struct bitonic_merge_args_1 *args = (struct bitonic_merge_args_1*)voidargs;
+    const struct bitonic_sorter *sorter = args->sorter;
     bool ascend = args->ascend;
     int lo = args->lo;
     int hi = args->hi;
     int number_threads = args->number_threads;
 
     if (hi <= lo + 1) return;
+    if (hi - lo <= BITONIC_BLOCK_ROWS) number_threads = 1;
+    if (number_threads <= 1 && bitonic_base_merge(sorter, ascend, lo, hi)) return;
 
     int mid_len = prev_pow_two(hi - lo);
+    bool fuse = hi - lo > BITONIC_BLOCK_ROWS && hi - lo == 2 * mid_len;
+    void (*pass)(void *) = fuse ? bitonic_merge_4 : bitonic_merge_2;
+    int stride = fuse ? mid_len / 2 : mid_len;
+    int pass_len = fuse ? stride : hi - mid_len - lo;
 
     if (number_threads <= 1) {
-        for (int i = lo; i < hi - mid_len; i++) {
-            bitonic_compare(ascend, i, i + mid_len);
-        }
+        struct bitonic_merge_args_2 args2 = {
+            .sorter = sorter,
+            .ascend = ascend,
+            .a = lo,
+            .b = lo + pass_len,
+            .c = stride,
+        };
+        pass(&args2);
     } else {
         struct bitonic_merge_args_2 args2[number_threads];
         int index_start[number_threads + 1];
         index_start[0] = lo;
-        int length_thread = (hi - mid_len - lo) / number_threads;
-        int length_extra = (hi - mid_len - lo) % number_threads;
+        int length_thread = pass_len / number_threads;
+        int length_extra = pass_len % number_threads;
         struct thread_work work[number_threads - 1];
         
         for (int i = 0; i < number_threads; i++) {
             index_start[i + 1] = index_start[i] + length_thread + (i < length_extra);
             
+            args2[i].sorter = sorter;
             args2[i].ascend = ascend;
             args2[i].a = index_start[i];
             args2[i].b = index_start[i + 1];
-            args2[i].c = mid_len;
+            args2[i].c = stride;
 
             if (i < number_threads - 1) {
                 work[i].type = THREAD_WORK_SINGLE;
-                work[i].single.func = bitonic_merge_2;
+                work[i].single.func = pass;
                 work[i].single.arg = args2 + i;
                 thread_work_push(&work[i]);
             }
         }
-        bitonic_merge_2(&args2[number_threads - 1]);
+        pass(&args2[number_threads - 1]);
         for (int i = 0; i < number_threads - 1; i++) {
             thread_wait(&work[i]);
         }
     }
 
-
-    if (1 < number_threads) {
-        int number_threads_left = number_threads / 2;
-        int number_threads_right = number_threads - number_threads_left;
-        struct bitonic_merge_args_1 args1 = {
-            .ascend = ascend,
-            .lo = lo,
-            .hi = lo + mid_len,
-            .number_threads = number_threads_left,
-        };
-        struct bitonic_merge_args_1 args2 = {
-            .ascend = ascend,
-            .lo = lo + mid_len,
-            .hi = hi,
-            .number_threads = number_threads_right,
-        };
-        struct thread_work work_;
-        work_.type = THREAD_WORK_SINGLE;
-        work_.single.func = bitonic_merge;
-        work_.single.arg = &args1;
-        thread_work_push(&work_);
-
-        bitonic_merge(&args2);
-
-        thread_wait(&work_);
+    if (fuse) {
+        int bounds[5] = {lo, lo + stride, lo + 2 * stride, lo + 3 * stride, hi};
+        bitonic_merge_parts(sorter, ascend, bounds, 4, number_threads);
     } else {
-        struct bitonic_merge_args_1 args1 = {
-            .ascend = ascend,
-            .lo = lo,
-            .hi = lo + mid_len,
-            .number_threads = 1,
-        };
-        struct bitonic_merge_args_1 args2 = {
-            .ascend = ascend,
-            .lo = lo + mid_len,
-            .hi = hi,
-            .number_threads = 1,
-        };
-
-        bitonic_merge(&args1);
-        bitonic_merge(&args2);
+        int bounds[3] = {lo, lo + mid_len, hi};
+        bitonic_merge_parts(sorter, ascend, bounds, 2, number_threads);
     }
-
-    return;
 }
 
 void bitonic_sort_new(void *voidargs) {
     struct bitonic_sort_new_args *args = (struct bitonic_sort_new_args*)voidargs;
+    const struct bitonic_sorter *sorter = args->sorter;
     bool ascend = args->ascend;
     int lo = args->lo;
     int hi = args->hi;
@@ -175,15 +375,19 @@ void bitonic_sort_new(void *voidargs) {
     int mid = lo + (hi - lo) / 2;
 
     if (mid == lo) return;
-    
+    if (hi - lo <= BITONIC_BLOCK_ROWS) number_threads = 1;
+    if (number_threads <= 1 && bitonic_base_sort(sorter, ascend, lo, hi)) return;
+
     if (number_threads <= 1) {
         struct bitonic_sort_new_args args1 = {
+                .sorter = sorter,
                 .ascend = !ascend,
                 .lo = lo,
                 .hi = mid,
                 .number_threads = 1,
         };
         struct bitonic_sort_new_args args2 = {
+                .sorter = sorter,
                 .ascend = ascend,
                 .lo = mid,
                 .hi = hi,
@@ -196,12 +400,14 @@ void bitonic_sort_new(void *voidargs) {
         int number_threads_left = number_threads / 2;
         int number_threads_right = number_threads - number_threads_left;
         struct bitonic_sort_new_args args1 = {
+                .sorter = sorter,
                 .ascend = !ascend,
                 .lo = lo,
                 .hi = mid,
                 .number_threads = number_threads_left,
         };
         struct bitonic_sort_new_args args2 = {
+                .sorter = sorter,
                 .ascend = ascend,
                 .lo = mid,
                 .hi = hi,
@@ -220,6 +426,7 @@ void bitonic_sort_new(void *voidargs) {
     };
 
     struct bitonic_merge_args_1 args_merge = {
+        .sorter = sorter,
         .ascend = ascend,
         .lo = lo,
         .hi = hi,
@@ -228,17 +435,88 @@ void bitonic_sort_new(void *voidargs) {
     bitonic_merge(&args_merge);
 }
 
-void bitonic_sort_(elem_t *arr_, bool ascend, int lo, int hi, int number_threads, bool D2enable) {
+static enum sort_engine default_engine = SORT_BITONIC;
 
-    arr = arr_;
-    dimension2D = D2enable;
-    struct bitonic_merge_args_1 args = {
+void set_sort_engine(enum sort_engine engine) {
+    default_engine = engine;
+}
+
+enum sort_engine get_sort_engine(void) {
+    return default_engine;
+}
+
+const char *sort_engine_name(enum sort_engine engine) {
+    switch (engine) {
+    case SORT_BUCKET:
+        return "bucket";
+    case SORT_SHUFFLE:
+        return "shuffle";
+    case SORT_TAG:
+        return "tag";
+    default:
+        return "bitonic";
+    }
+}
+
+void bitonic_sorter_init(struct bitonic_sorter *sorter, elem_t *arr,
+        int num_threads, bool D2enable) {
+    sorter->arr = arr;
+    sorter->num_threads = num_threads;
+    sorter->dimension2D = D2enable;
+    sorter->engine = default_engine;
+}
+
+void bitonic_sorter_sort(const struct bitonic_sorter *sorter, bool ascend,
+        int lo, int hi) {
+    if (sorter->engine == SORT_BUCKET) {
+        bucket_sort_(sorter->arr, ascend, lo, hi, sorter->num_threads,
+                sorter->dimension2D);
+        return;
+    }
+    if (sorter->engine == SORT_SHUFFLE) {
+        shuffle_sort_(sorter->arr, ascend, lo, hi, sorter->num_threads);
+        return;
+    }
+    if (sorter->engine == SORT_TAG) {
+        tag_sort_(sorter->arr, ascend, lo, hi, sorter->num_threads,
+                sorter->dimension2D);
+        return;
+    }
+    struct bitonic_sort_new_args args = {
+        .sorter = sorter,
         .ascend = ascend,
         .lo = lo,
         .hi = hi,
-        .number_threads = number_threads,
+        .number_threads = sorter->num_threads,
     };
     bitonic_sort_new(&args);
+}
 
-    return;
+static void bitonic_job_run(void *voidargs) {
+    struct bitonic_sort_new_args *args = (struct bitonic_sort_new_args*)voidargs;
+    bitonic_sorter_sort(args->sorter, args->ascend, args->lo, args->hi);
+}
+
+void bitonic_sorter_start(struct bitonic_job *job,
+        const struct bitonic_sorter *sorter, bool ascend, int lo, int hi) {
+    job->args.sorter = sorter;
+    job->args.ascend = ascend;
+    job->args.lo = lo;
+    job->args.hi = hi;
+    job->args.number_threads = sorter->num_threads;
+    job->work.type = THREAD_WORK_SINGLE;
+    job->work.single.func = bitonic_job_run;
+    job->work.single.arg = &job->args;
+    thread_work_push(&job->work);
+}
+
+void bitonic_sorter_wait(struct bitonic_job *job) {
+    thread_wait(&job->work);
+}
+
+void bitonic_sort_(elem_t *arr_, bool ascend, int lo, int hi, int number_threads, bool D2enable) {
+    struct bitonic_sorter sorter;
+    bitonic_sorter_init(&sorter, arr_, number_threads, D2enable);
+    sorter.engine = SORT_BITONIC;
+    bitonic_sorter_sort(&sorter, ascend, lo, hi);
 }
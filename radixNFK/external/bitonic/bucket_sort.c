@@ -0,0 +1,460 @@
+#include "bucket_sort.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include <liboblivious/primitives.h>
+#include "threading.h"
+
+/* slots per bucket (Z); a power of two, half of them filled at the start */
+#ifndef BUCKET_SIZE
+#define BUCKET_SIZE 512
+#endif
+#define BUCKET_DUMMY UINT32_MAX
+
+/* bucket label and input position of a slot, pos is BUCKET_DUMMY for a filler */
+struct bucket_tag {
+    uint32_t label;
+    uint32_t pos;
+};
+
+/* what the final sort orders by: key (and idx), then the row's place in the
+   shuffled ctx->rows, so no two rows compare equal */
+struct sort_key {
+    uint64_t key;
+    uint64_t slot;
+};
+
+struct bucket_sort_ctx {
+    elem_t *arr; /* arr[lo] of the caller */
+    size_t n;
+    bool ascend;
+    size_t num_chunks;
+
+    /* num_buckets * BUCKET_SIZE slots, one bucket after the other */
+    elem_t *bucket_rows;
+    struct bucket_tag *bucket_tags;
+    size_t num_buckets;
+    unsigned int level;
+    uint64_t seed;
+    bool overflow;
+
+    size_t *offsets; /* first output position of every bucket */
+    uint64_t shuffle_seed;
+    elem_t *rows; /* the rows in random order */
+    struct sort_key *runs;
+    struct sort_key *runs_out;
+    size_t run_len;
+};
+
+static void *bucket_alloc(size_t bytes) {
+    void *p;
+    if (posix_memalign(&p, 64, bytes ? bytes : 1)) {
+        printf("Couldn't allocate %zu bytes for the bucket sort\n", bytes);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/* runs fn(ctx, i) for i in [0, count) on the thread system */
+static void run_chunks(void (*fn)(void *arg, size_t i),
+        struct bucket_sort_ctx *ctx, size_t count) {
+    thread_run_iter(fn, ctx, count);
+}
+
+static inline size_t chunk_begin(size_t n, size_t i, size_t chunks) {
+    return n * (i < chunks ? i : chunks) / chunks;
+}
+
+static inline uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t fresh_seed(void) {
+    uint64_t seed;
+    if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed)) {
+        seed = (uint64_t) time(NULL) ^ (uint64_t) clock();
+    }
+    return seed;
+}
+
+static inline void oswap_row(elem_t *ra, elem_t *rb, bool cond) {
+#ifdef __AVX2__
+    const __m256i mask = _mm256_set1_epi64x(-(long long) cond);
+    __m256i va = _mm256_loadu_si256((const __m256i *) ra);
+    __m256i vb = _mm256_loadu_si256((const __m256i *) rb);
+    __m256i x = _mm256_and_si256(_mm256_xor_si256(va, vb), mask);
+    _mm256_storeu_si256((__m256i *) ra, _mm256_xor_si256(va, x));
+    _mm256_storeu_si256((__m256i *) rb, _mm256_xor_si256(vb, x));
+#else
+    o_memswap(ra, rb, sizeof(*ra), cond);
+#endif
+}
+
+static inline void oswap_u64(void *pa, void *pb, bool cond) {
+    uint64_t a, b;
+    memcpy(&a, pa, sizeof(a));
+    memcpy(&b, pb, sizeof(b));
+    uint64_t t = (a ^ b) & -(uint64_t) cond;
+    a ^= t;
+    b ^= t;
+    memcpy(pa, &a, sizeof(a));
+    memcpy(pb, &b, sizeof(b));
+}
+
+/* swaps slot a with slot b, rows and tags, if cond */
+static inline void oswap_slot(elem_t *ra, struct bucket_tag *ta, elem_t *rb,
+        struct bucket_tag *tb, bool cond) {
+    oswap_row(ra, rb, cond);
+    oswap_u64(ta, tb, cond);
+}
+
+/*
+ * ORCompact's offset compaction for n a power of two: moves the marked slots
+ * of [0, n) to the front, in order, and rotates the result left by z. pre[i]
+ * is the number of marked slots before slot i on entry.
+ */
+static void or_off_compact(elem_t *rows, struct bucket_tag *tags,
+        const uint32_t *pre, size_t n, size_t z) {
+    if (n == 1) return;
+    if (n == 2) {
+        bool m0 = pre[1] - pre[0];
+        bool m1 = pre[2] - pre[1];
+        oswap_slot(&rows[0], &tags[0], &rows[1], &tags[1],
+                ((!m0) & m1) ^ (z & 1));
+        return;
+    }
+
+    const size_t half = n / 2;
+    const size_t m = pre[half] - pre[0];
+    or_off_compact(rows, tags, pre, half, z & (half - 1));
+    or_off_compact(rows + half, tags + half, pre + half, half,
+            (z + m) & (half - 1));
+
+    const bool s = (((z & (half - 1)) + m) >= half) ^ (z >= half);
+    const size_t t = (z + m) & (half - 1);
+    for (size_t i = 0; i < half; i++) {
+        oswap_slot(&rows[i], &tags[i], &rows[i + half], &tags[i + half],
+                s ^ (i >= t));
+    }
+}
+
+/*
+ * Merges buckets a and b and splits the rows by label bit: rows with the bit
+ * clear go to a, the others to b, both padded with fillers. Returns false if
+ * one side got more than BUCKET_SIZE rows. pre has room for 2 BUCKET_SIZE + 1
+ * counts.
+ */
+static bool merge_split(const struct bucket_sort_ctx *ctx, size_t a, size_t b,
+        uint32_t *pre) {
+    const uint32_t z = BUCKET_SIZE;
+    const unsigned int bit = ctx->level;
+    elem_t *rows[2] = {ctx->bucket_rows + a * z, ctx->bucket_rows + b * z};
+    struct bucket_tag *tags[2] = {ctx->bucket_tags + a * z,
+        ctx->bucket_tags + b * z};
+
+    uint32_t c0 = 0, c1 = 0;
+    for (int h = 0; h < 2; h++) {
+        for (uint32_t i = 0; i < z; i++) {
+            uint32_t real = tags[h][i].pos != BUCKET_DUMMY;
+            uint32_t right = (tags[h][i].label >> bit) & 1;
+            c0 += real & !right;
+            c1 += real & right;
+        }
+    }
+    const bool ok = (c0 <= z) & (c1 <= z);
+
+    /* the first z - c0 fillers go left with the rows whose bit is clear */
+    const uint32_t fill = (z - c0) & -(uint32_t) ok;
+    uint32_t fillers = 0;
+    pre[0] = 0;
+    for (int h = 0; h < 2; h++) {
+        for (uint32_t i = 0; i < z; i++) {
+            uint32_t real = tags[h][i].pos != BUCKET_DUMMY;
+            uint32_t right = (tags[h][i].label >> bit) & 1;
+            uint32_t mark = (real & !right) | (!real & (fillers < fill));
+            fillers += !real;
+            pre[h * z + i + 1] = pre[h * z + i] + mark;
+        }
+    }
+
+    /* or_off_compact of a followed by b, without copying them together */
+    const uint32_t m = pre[z];
+    or_off_compact(rows[0], tags[0], pre, z, 0);
+    or_off_compact(rows[1], tags[1], pre + z, z, m & (z - 1));
+    const bool s = m >= z;
+    const uint32_t t = m & (z - 1);
+    for (uint32_t i = 0; i < z; i++) {
+        oswap_slot(&rows[0][i], &tags[0][i], &rows[1][i], &tags[1][i],
+                s ^ (i >= t));
+    }
+    return ok;
+}
+
+static void fill_buckets(void *arg, size_t chunk) {
+    struct bucket_sort_ctx *ctx = arg;
+    const size_t half = BUCKET_SIZE / 2;
+    const size_t first = chunk_begin(ctx->num_buckets, chunk, ctx->num_chunks);
+    const size_t last = chunk_begin(ctx->num_buckets, chunk + 1, ctx->num_chunks);
+
+    for (size_t bk = first; bk < last; bk++) {
+        elem_t *rows = ctx->bucket_rows + bk * BUCKET_SIZE;
+        struct bucket_tag *tags = ctx->bucket_tags + bk * BUCKET_SIZE;
+        for (size_t s = 0; s < BUCKET_SIZE; s++) {
+            const size_t i = bk * half + s;
+            if (s < half && i < ctx->n) {
+                rows[s] = ctx->arr[i];
+                tags[s].label = (uint32_t) splitmix64(ctx->seed + i)
+                    & (uint32_t) (ctx->num_buckets - 1);
+                tags[s].pos = (uint32_t) i;
+            } else {
+                memset(&rows[s], 0, sizeof(rows[s]));
+                tags[s].label = 0;
+                tags[s].pos = BUCKET_DUMMY;
+            }
+        }
+    }
+}
+
+static void route_level(void *arg, size_t chunk) {
+    struct bucket_sort_ctx *ctx = arg;
+    const size_t pairs = ctx->num_buckets / 2;
+    const size_t first = chunk_begin(pairs, chunk, ctx->num_chunks);
+    const size_t last = chunk_begin(pairs, chunk + 1, ctx->num_chunks);
+    if (first == last) return;
+
+    uint32_t *pre = bucket_alloc((2 * BUCKET_SIZE + 1) * sizeof(*pre));
+    const size_t low = ((size_t) 1 << ctx->level) - 1;
+    bool ok = true;
+
+    for (size_t p = first; p < last; p++) {
+        const size_t j = ((p & ~low) << 1) | (p & low);
+        ok &= merge_split(ctx, j, j | (low + 1), pre);
+    }
+    if (!ok) {
+        __atomic_store_n(&ctx->overflow, true, __ATOMIC_RELAXED);
+    }
+    free(pre);
+}
+
+/* compare-exchange by random tag, as part of shuffle_sort */
+static inline void shuffle_cmpx(elem_t *rows, uint64_t *tags, size_t i,
+        size_t j, bool ascend) {
+    bool cond = (tags[i] > tags[j]) == ascend;
+    oswap_row(&rows[i], &rows[j], cond);
+    oswap_u64(&tags[i], &tags[j], cond);
+}
+
+static void shuffle_merge(elem_t *rows, uint64_t *tags, size_t lo, size_t n,
+        bool ascend) {
+    if (n < 2) return;
+    size_t m = 1;
+    while (2 * m < n) m *= 2;
+    for (size_t i = lo; i < lo + n - m; i++) {
+        shuffle_cmpx(rows, tags, i, i + m, ascend);
+    }
+    shuffle_merge(rows, tags, lo, m, ascend);
+    shuffle_merge(rows, tags, lo + m, n - m, ascend);
+}
+
+/* bitonic sort of rows[lo, lo + n) by tags; with random tags an oblivious
+   random permutation */
+static void shuffle_sort(elem_t *rows, uint64_t *tags, size_t lo, size_t n,
+        bool ascend) {
+    if (n < 2) return;
+    const size_t h = n / 2;
+    shuffle_sort(rows, tags, lo, h, !ascend);
+    shuffle_sort(rows, tags, lo + h, n - h, ascend);
+    shuffle_merge(rows, tags, lo, n, ascend);
+}
+
+/*
+ * Every bucket now holds the rows labelled with its index. Drops the fillers
+ * and writes the rows of every bucket, obliviously shuffled, to
+ * ctx->rows[offsets[bucket] ...]: the routing keeps the rows of a bucket in
+ * their input order, so without the shuffle that order would show through.
+ */
+static void gather_rows(void *arg, size_t chunk) {
+    struct bucket_sort_ctx *ctx = arg;
+    const size_t first = chunk_begin(ctx->num_buckets, chunk, ctx->num_chunks);
+    const size_t last = chunk_begin(ctx->num_buckets, chunk + 1, ctx->num_chunks);
+    uint64_t tags[BUCKET_SIZE];
+
+    for (size_t bk = first; bk < last; bk++) {
+        const elem_t *rows = ctx->bucket_rows + bk * BUCKET_SIZE;
+        const struct bucket_tag *btags = ctx->bucket_tags + bk * BUCKET_SIZE;
+        elem_t *out = ctx->rows + ctx->offsets[bk];
+        size_t n = 0;
+        for (size_t s = 0; s < BUCKET_SIZE; s++) {
+            if (btags[s].pos != BUCKET_DUMMY) {
+                tags[n] = splitmix64(ctx->shuffle_seed + ctx->offsets[bk] + n);
+                out[n++] = rows[s];
+            }
+        }
+        shuffle_sort(out, tags, 0, n, true);
+    }
+}
+
+static inline bool key_less(const struct sort_key *a, const struct sort_key *b) {
+    return a->key < b->key || (a->key == b->key && a->slot < b->slot);
+}
+
+/* equal keys are ordered by the unique idx, never by the shuffled slot, so
+   the comparisons of the sort below do not depend on how often a key occurs */
+static void make_keys(void *arg, size_t chunk) {
+    struct bucket_sort_ctx *ctx = arg;
+    const size_t first = chunk_begin(ctx->n, chunk, ctx->num_chunks);
+    const size_t last = chunk_begin(ctx->n, chunk + 1, ctx->num_chunks);
+    for (size_t i = first; i < last; i++) {
+        const elem_t *row = &ctx->rows[i];
+        uint64_t key = (uint64_t) row->key << 32 | row->idx;
+        ctx->runs[i].key = ctx->ascend ? key : ~key;
+        ctx->runs[i].slot = i;
+    }
+}
+
+static void merge_keys(const struct sort_key *x, size_t nx,
+        const struct sort_key *y, size_t ny, struct sort_key *out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < nx && j < ny) {
+        out[k++] = key_less(&y[j], &x[i]) ? y[j++] : x[i++];
+    }
+    while (i < nx) out[k++] = x[i++];
+    while (j < ny) out[k++] = y[j++];
+}
+
+/* merge sort of a[0, n), tmp[0, n) being scratch space */
+static void sort_keys(struct sort_key *a, struct sort_key *tmp, size_t n) {
+    if (n <= 16) {
+        for (size_t i = 1; i < n; i++) {
+            struct sort_key v = a[i];
+            size_t j = i;
+            for (; j > 0 && key_less(&v, &a[j - 1]); j--) {
+                a[j] = a[j - 1];
+            }
+            a[j] = v;
+        }
+        return;
+    }
+    const size_t h = n / 2;
+    sort_keys(a, tmp, h);
+    sort_keys(a + h, tmp + h, n - h);
+    merge_keys(a, h, a + h, n - h, tmp);
+    memcpy(a, tmp, n * sizeof(*a));
+}
+
+static void sort_run(void *arg, size_t chunk) {
+    struct bucket_sort_ctx *ctx = arg;
+    const size_t first = chunk_begin(ctx->n, chunk, ctx->num_chunks);
+    const size_t last = chunk_begin(ctx->n, chunk + 1, ctx->num_chunks);
+    sort_keys(ctx->runs + first, ctx->runs_out + first, last - first);
+}
+
+/* merges runs 2p and 2p + 1 of run_len chunks each into runs_out */
+static void merge_runs(void *arg, size_t p) {
+    struct bucket_sort_ctx *ctx = arg;
+    const size_t c = ctx->num_chunks;
+    const size_t lo = chunk_begin(ctx->n, 2 * p * ctx->run_len, c);
+    const size_t mid = chunk_begin(ctx->n, (2 * p + 1) * ctx->run_len, c);
+    const size_t hi = chunk_begin(ctx->n, (2 * p + 2) * ctx->run_len, c);
+    merge_keys(ctx->runs + lo, mid - lo, ctx->runs + mid, hi - mid,
+            ctx->runs_out + lo);
+}
+
+static void write_rows(void *arg, size_t chunk) {
+    struct bucket_sort_ctx *ctx = arg;
+    const size_t first = chunk_begin(ctx->n, chunk, ctx->num_chunks);
+    const size_t last = chunk_begin(ctx->n, chunk + 1, ctx->num_chunks);
+    for (size_t i = first; i < last; i++) {
+        ctx->arr[i] = ctx->rows[ctx->runs[i].slot];
+    }
+}
+
+/* routes ctx->arr into the buckets and gathers it, shuffled, into ctx->rows */
+static void bucket_permute(struct bucket_sort_ctx *ctx) {
+    /* at most BUCKET_SIZE / 2 rows start in each bucket */
+    unsigned int levels = 0;
+    while (((size_t) BUCKET_SIZE / 2 << levels) < ctx->n) levels++;
+    ctx->num_buckets = (size_t) 1 << levels;
+    const size_t slots = ctx->num_buckets * BUCKET_SIZE;
+    ctx->bucket_rows = bucket_alloc(slots * sizeof(*ctx->bucket_rows));
+    ctx->bucket_tags = bucket_alloc(slots * sizeof(*ctx->bucket_tags));
+
+    do {
+        ctx->seed = fresh_seed();
+        ctx->overflow = false;
+        run_chunks(fill_buckets, ctx, ctx->num_chunks);
+        for (ctx->level = 0; ctx->level < levels; ctx->level++) {
+            run_chunks(route_level, ctx, ctx->num_chunks);
+        }
+    } while (ctx->overflow);
+
+    ctx->offsets = bucket_alloc(ctx->num_buckets * sizeof(*ctx->offsets));
+    size_t total = 0;
+    for (size_t bk = 0; bk < ctx->num_buckets; bk++) {
+        ctx->offsets[bk] = total;
+        const struct bucket_tag *tags = ctx->bucket_tags + bk * BUCKET_SIZE;
+        for (size_t s = 0; s < BUCKET_SIZE; s++) {
+            total += tags[s].pos != BUCKET_DUMMY;
+        }
+    }
+
+    ctx->shuffle_seed = fresh_seed();
+    run_chunks(gather_rows, ctx, ctx->num_chunks);
+    free(ctx->offsets);
+    free(ctx->bucket_tags);
+    free(ctx->bucket_rows);
+}
+
+void bucket_shuffle_(elem_t *arr, int lo, int hi, int num_threads) {
+    if (hi - lo < 2) return;
+
+    struct bucket_sort_ctx ctx = {
+        .arr = arr + lo,
+        .n = (size_t) (hi - lo),
+        .num_chunks = num_threads > 1 ? (size_t) num_threads : 1,
+    };
+    ctx.rows = ctx.arr;
+    bucket_permute(&ctx);
+}
+
+void bucket_sort_(elem_t *arr, bool ascend, int lo, int hi, int num_threads,
+        bool D2enable) {
+    (void) D2enable; /* the idx breaks every tie anyway */
+    if (hi - lo < 2) return;
+
+    struct bucket_sort_ctx ctx = {
+        .arr = arr + lo,
+        .n = (size_t) (hi - lo),
+        .ascend = ascend,
+        .num_chunks = num_threads > 1 ? (size_t) num_threads : 1,
+    };
+    ctx.rows = bucket_alloc(ctx.n * sizeof(*ctx.rows));
+    bucket_permute(&ctx);
+
+    /* the keys are sorted per chunk and the runs merged pairwise */
+    ctx.runs = bucket_alloc(ctx.n * sizeof(*ctx.runs));
+    ctx.runs_out = bucket_alloc(ctx.n * sizeof(*ctx.runs_out));
+    run_chunks(make_keys, &ctx, ctx.num_chunks);
+    run_chunks(sort_run, &ctx, ctx.num_chunks);
+    for (ctx.run_len = 1; ctx.run_len < ctx.num_chunks; ctx.run_len *= 2) {
+        const size_t pairs = (ctx.num_chunks + 2 * ctx.run_len - 1) / (2 * ctx.run_len);
+        run_chunks(merge_runs, &ctx, pairs);
+        struct sort_key *t = ctx.runs;
+        ctx.runs = ctx.runs_out;
+        ctx.runs_out = t;
+    }
+    run_chunks(write_rows, &ctx, ctx.num_chunks);
+
+    free(ctx.runs);
+    free(ctx.runs_out);
+    free(ctx.rows);
+}
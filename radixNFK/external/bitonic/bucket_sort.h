@@ -0,0 +1,34 @@
+#ifndef BUCKET_SORT_H
+#define BUCKET_SORT_H
+
+#include <stdbool.h>
+#include "elem_t.h"
+
+/*
+ * Bucket oblivious sort [Asharov et al., SOSA'20], O(n log n) work against
+ * the O(n log^2 n) of the bitonic sort.
+ *
+ * Every row gets a secret random bucket label and is routed to its bucket
+ * through a butterfly of buckets with BUCKET_SIZE slots. Each butterfly step
+ * merges two buckets and splits them by one label bit with an oblivious
+ * compaction [Sasy et al., CCS'22], and a small bitonic sort by random tags
+ * finally shuffles every bucket, so the access pattern only depends on the
+ * number of rows. The rows then sit in a random order nobody knows, and a
+ * plain comparison sort on that order reveals nothing about the keys.
+ */
+
+/*
+ * Sorts arr[lo, hi) by key and idx, which must be unique, with num_threads
+ * threads of the thread system, like bitonic_sort_ (with or without
+ * D2enable). Breaking the ties on idx keeps the comparisons independent of
+ * the key multiplicities. If a bucket would overflow, which happens with
+ * negligible probability, the routing is redone with fresh labels.
+ */
+void bucket_sort_(elem_t *arr, bool ascend, int lo, int hi, int num_threads,
+        bool D2enable);
+
+/* The routing and shuffle alone: an oblivious, uniformly random permutation
+   of arr[lo, hi). */
+void bucket_shuffle_(elem_t *arr, int lo, int hi, int num_threads);
+
+#endif /* BUCKET_SORT_H */
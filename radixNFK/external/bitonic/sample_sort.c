@@ -0,0 +1,191 @@
+#include "sample_sort.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bucket_sort.h"
+#include "threading.h"
+
+/* samples drawn per splitter, and buckets per thread */
+#define SAMPLE_OVERSAMPLING 64
+#define SAMPLE_BUCKETS_PER_THREAD 4
+/* inputs up to this size are sorted by one thread */
+#define SAMPLE_SERIAL_ROWS 4096
+
+struct sample_sort_ctx {
+    elem_t *arr;
+    elem_t *tmp;
+    size_t n;
+    bool ascend;
+    size_t num_chunks;
+
+    size_t num_buckets;
+    elem_t *splitters;     /* num_buckets - 1 of them */
+    uint16_t *bucket_of;   /* bucket of every row */
+    size_t *offsets;       /* [chunk][bucket]: first slot in tmp */
+    size_t *bucket_begin;  /* num_buckets + 1 */
+};
+
+static void *sample_alloc(size_t bytes) {
+    void *p;
+    if (posix_memalign(&p, 64, bytes ? bytes : 1)) {
+        printf("Couldn't allocate %zu bytes for the samplesort\n", bytes);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static inline size_t chunk_begin(size_t n, size_t i, size_t chunks) {
+    return n * i / chunks;
+}
+
+static inline bool row_less(const elem_t *a, const elem_t *b, bool ascend) {
+    bool less = a->key < b->key || (a->key == b->key && a->idx < b->idx);
+    bool greater = a->key > b->key || (a->key == b->key && a->idx > b->idx);
+    return ascend ? less : greater;
+}
+
+static void merge_rows(const elem_t *x, size_t nx, const elem_t *y, size_t ny,
+        elem_t *out, bool ascend) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < nx && j < ny) {
+        out[k++] = row_less(&y[j], &x[i], ascend) ? y[j++] : x[i++];
+    }
+    while (i < nx) out[k++] = x[i++];
+    while (j < ny) out[k++] = y[j++];
+}
+
+/* merge sort of a[0, n), tmp[0, n) being scratch space */
+static void sort_rows(elem_t *a, elem_t *tmp, size_t n, bool ascend) {
+    if (n <= 16) {
+        for (size_t i = 1; i < n; i++) {
+            elem_t v = a[i];
+            size_t j = i;
+            for (; j > 0 && row_less(&v, &a[j - 1], ascend); j--) {
+                a[j] = a[j - 1];
+            }
+            a[j] = v;
+        }
+        return;
+    }
+    const size_t h = n / 2;
+    sort_rows(a, tmp, h, ascend);
+    sort_rows(a + h, tmp + h, n - h, ascend);
+    merge_rows(a, h, a + h, n - h, tmp, ascend);
+    memcpy(a, tmp, n * sizeof(*a));
+}
+
+/* number of splitters that precede row */
+static inline size_t find_bucket(const struct sample_sort_ctx *ctx,
+        const elem_t *row) {
+    size_t lo = 0, hi = ctx->num_buckets - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (row_less(&ctx->splitters[mid], row, ctx->ascend)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void count_buckets(void *arg, size_t chunk) {
+    struct sample_sort_ctx *ctx = arg;
+    const size_t first = chunk_begin(ctx->n, chunk, ctx->num_chunks);
+    const size_t last = chunk_begin(ctx->n, chunk + 1, ctx->num_chunks);
+    size_t *count = ctx->offsets + chunk * ctx->num_buckets;
+
+    memset(count, 0, ctx->num_buckets * sizeof(*count));
+    for (size_t i = first; i < last; i++) {
+        size_t b = find_bucket(ctx, &ctx->arr[i]);
+        ctx->bucket_of[i] = (uint16_t) b;
+        count[b]++;
+    }
+}
+
+static void scatter_rows(void *arg, size_t chunk) {
+    struct sample_sort_ctx *ctx = arg;
+    const size_t first = chunk_begin(ctx->n, chunk, ctx->num_chunks);
+    const size_t last = chunk_begin(ctx->n, chunk + 1, ctx->num_chunks);
+    size_t *next = ctx->offsets + chunk * ctx->num_buckets;
+
+    for (size_t i = first; i < last; i++) {
+        ctx->tmp[next[ctx->bucket_of[i]]++] = ctx->arr[i];
+    }
+}
+
+/* sorts bucket b in tmp, with its range of arr as scratch, and copies it
+   back to arr */
+static void sort_bucket(void *arg, size_t b) {
+    struct sample_sort_ctx *ctx = arg;
+    const size_t first = ctx->bucket_begin[b];
+    const size_t n = ctx->bucket_begin[b + 1] - first;
+    sort_rows(ctx->tmp + first, ctx->arr + first, n, ctx->ascend);
+    memcpy(ctx->arr + first, ctx->tmp + first, n * sizeof(*ctx->arr));
+}
+
+void sample_sort_(elem_t *arr, bool ascend, int lo, int hi, int num_threads) {
+    if (hi - lo < 2) return;
+
+    struct sample_sort_ctx ctx = {
+        .arr = arr + lo,
+        .n = (size_t) (hi - lo),
+        .ascend = ascend,
+        .num_chunks = num_threads > 1 ? (size_t) num_threads : 1,
+    };
+    ctx.tmp = sample_alloc(ctx.n * sizeof(*ctx.tmp));
+
+    if (ctx.num_chunks == 1 || ctx.n <= SAMPLE_SERIAL_ROWS) {
+        sort_rows(ctx.arr, ctx.tmp, ctx.n, ascend);
+        free(ctx.tmp);
+        return;
+    }
+
+    /* the rows are in random order, so evenly spaced ones are a random
+       sample */
+    ctx.num_buckets = ctx.num_chunks * SAMPLE_BUCKETS_PER_THREAD;
+    if (ctx.num_buckets > UINT16_MAX) ctx.num_buckets = UINT16_MAX;
+    size_t num_samples = ctx.num_buckets * SAMPLE_OVERSAMPLING;
+    if (num_samples > ctx.n) num_samples = ctx.n;
+    elem_t *samples = sample_alloc(2 * num_samples * sizeof(*samples));
+    for (size_t i = 0; i < num_samples; i++) {
+        samples[i] = ctx.arr[chunk_begin(ctx.n, i, num_samples)];
+    }
+    sort_rows(samples, samples + num_samples, num_samples, ascend);
+    ctx.splitters = sample_alloc((ctx.num_buckets - 1) * sizeof(*ctx.splitters));
+    for (size_t b = 1; b < ctx.num_buckets; b++) {
+        ctx.splitters[b - 1] = samples[chunk_begin(num_samples, b, ctx.num_buckets)];
+    }
+    free(samples);
+
+    ctx.bucket_of = sample_alloc(ctx.n * sizeof(*ctx.bucket_of));
+    ctx.offsets = sample_alloc(ctx.num_chunks * ctx.num_buckets * sizeof(*ctx.offsets));
+    ctx.bucket_begin = sample_alloc((ctx.num_buckets + 1) * sizeof(*ctx.bucket_begin));
+    thread_run_iter(count_buckets, &ctx, ctx.num_chunks);
+
+    size_t total = 0;
+    for (size_t b = 0; b < ctx.num_buckets; b++) {
+        ctx.bucket_begin[b] = total;
+        for (size_t c = 0; c < ctx.num_chunks; c++) {
+            size_t count = ctx.offsets[c * ctx.num_buckets + b];
+            ctx.offsets[c * ctx.num_buckets + b] = total;
+            total += count;
+        }
+    }
+    ctx.bucket_begin[ctx.num_buckets] = total;
+
+    thread_run_iter(scatter_rows, &ctx, ctx.num_chunks);
+    thread_run_iter(sort_bucket, &ctx, ctx.num_buckets);
+
+    free(ctx.bucket_begin);
+    free(ctx.offsets);
+    free(ctx.bucket_of);
+    free(ctx.splitters);
+    free(ctx.tmp);
+}
+
+void shuffle_sort_(elem_t *arr, bool ascend, int lo, int hi, int num_threads) {
+    bucket_shuffle_(arr, lo, hi, num_threads);
+    sample_sort_(arr, ascend, lo, hi, num_threads);
+}
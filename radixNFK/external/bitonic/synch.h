@@ -14,8 +14,22 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+/*
+ * The spinlock and the semaphore spin for a while (not at all on a single
+ * CPU) and then park the waiter on a futex, so idle threads do not keep a
+ * core busy during the sequential parts of the join.
+ */
+
+/* Sleeps while *word == val; may return spuriously. */
+void sync_wait(volatile unsigned int *word, unsigned int val);
+/* Wakes up to count threads sleeping on word. */
+void sync_wake(volatile unsigned int *word, int count);
+/* Number of polls before a waiter parks. */
+unsigned int sync_spin_limit(void);
+
 typedef struct spinlock {
-    volatile bool locked;
+    /* 0: unlocked, 1: locked, 2: locked with sleeping waiters */
+    volatile unsigned int locked;
 } spinlock_t;
 
 void spinlock_init(spinlock_t *lock);
@@ -24,12 +38,14 @@ bool spinlock_trylock(spinlock_t *lock);
 void spinlock_unlock(spinlock_t *lock);
 
 typedef struct sema {
+    /* count, plus SEMA_SLEEPERS once a waiter has gone to sleep */
     volatile unsigned int value;
 } sema_t;
 
 void sema_init(sema_t *sema, unsigned int initial_value);
 void sema_up(sema_t *sema);
 void sema_down(sema_t *sema);
+bool sema_trydown(sema_t *sema);
 
 typedef struct condvar {
     struct condvar_waiter *head;
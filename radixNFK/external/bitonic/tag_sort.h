@@ -0,0 +1,23 @@
+#ifndef TAG_SORT_H
+#define TAG_SORT_H
+
+#include <stdbool.h>
+#include "elem_t.h"
+
+/*
+ * Tag sort: the bitonic network runs on narrow tags instead of whole rows.
+ *
+ * The rows are first permuted by bucket_shuffle_. Every row then gets a
+ * 16-byte tag (key << 32 | idx, position), the tags are sorted by an AVX2
+ * bitonic network and the rows are gathered once into tag order. Equal keys
+ * are ordered by the unique idx, for 2D sorts and all others alike, so the
+ * gather reveals the permutation from shuffled to sorted order, which is
+ * uniformly random and independent of the input, and the whole sort stays
+ * oblivious. (key, idx) must be unique.
+ *
+ * Ties are always broken on idx, so D2enable has no effect.
+ */
+void tag_sort_(elem_t *arr, bool ascend, int lo, int hi, int num_threads,
+        bool D2enable);
+
+#endif /* TAG_SORT_H */
@@ -28,8 +28,6 @@ struct thread_work {
     };
 
     sema_t done;
-
-    struct thread_work *next;
 };
 
 extern size_t total_num_threads;
@@ -39,10 +37,19 @@ void thread_system_init(void); // added
 void thread_system_cleanup(void); // added
 void thread_work_push(struct thread_work *work);
 void thread_wait(struct thread_work *work);
+/* Pushes fn(arg, i) for every i in [0, count) as one iterated item and helps
+   with it until all calls are done. */
+void thread_run_iter(void (*fn)(void *arg, size_t i), void *arg, size_t count);
 void thread_start_work(void);
 void thread_work_until_empty(void);
 void thread_wait_for_all(void);
 void thread_release_all(void);
 void thread_unrelease_all(void);
 
+/* Runs main_fn(arg, n) on the calling thread while n - 1 further workers of
+   its worker pool team serve the work list, n = min(num_threads, team size),
+   and releases them once main_fn returns. */
+void thread_run_on_pool(void (*main_fn)(void *arg, size_t num_threads),
+        void *arg, size_t num_threads);
+
 #endif /* distributed-sgx-sort/enclave/threading.h */
@@ -0,0 +1,72 @@
+#include "bin_layout.h"
+#include <stddef.h>
+#include <string.h>
+
+#define HASH_BIT_MODULO(K, MASK, NBITS) (((K) & MASK) >> NBITS)
+#define HASH_KEY(K, STRIDE, I) (*(const uint32_t *)((K) + (I) * (STRIDE)))
+
+uint32_t bin_layout_max_slots(uint64_t num, uint32_t bins) {
+  /* every non-empty bin pads at most BIN_LANES - 1 slots */
+  const uint64_t padded = num < bins ? num : bins;
+  return (uint32_t)(num + padded * (BIN_LANES - 1));
+}
+
+size_t bin_layout_room(uint64_t num, uint32_t bins) {
+  const uint32_t slots = bin_layout_max_slots(num, bins);
+  return 2 * SCRATCH_ROOM((bins + 1) * sizeof(uint32_t)) +
+         2 * SCRATCH_ROOM(slots * sizeof(uint32_t)) +
+         SCRATCH_ROOM(num * sizeof(uint32_t));
+}
+
+/* the hashKeys and keys of the tuples, stride bytes apart */
+static void layout(struct bin_layout *bl, struct scratch *s, const char *hash,
+                   const char *key, size_t stride, uint64_t num, uint32_t mask,
+                   int shift, uint32_t bins) {
+  uint32_t *fill = (uint32_t *)scratch_alloc(s, (bins + 1) * sizeof(uint32_t));
+  uint32_t b;
+  uint64_t i;
+
+  memset(fill, 0, bins * sizeof(uint32_t));
+  bl->start = (uint32_t *)scratch_alloc(s, (bins + 1) * sizeof(uint32_t));
+  bl->slot = (uint32_t *)scratch_alloc(s, num * sizeof(uint32_t));
+
+  for (i = 0; i < num; i++)
+    fill[HASH_BIT_MODULO(HASH_KEY(hash, stride, i), mask, shift)]++;
+  bl->slots = 0;
+  for (b = 0; b < bins; b++) {
+    bl->start[b] = bl->slots;
+    bl->slots += (fill[b] + BIN_LANES - 1) & ~(uint32_t)(BIN_LANES - 1);
+    fill[b] = bl->start[b];
+  }
+  bl->start[bins] = bl->slots;
+
+  bl->keys = (uint32_t *)scratch_alloc(s, bl->slots * sizeof(uint32_t));
+  bl->live = (uint32_t *)scratch_alloc(s, bl->slots * sizeof(uint32_t));
+  memset(bl->keys, 0, bl->slots * sizeof(uint32_t));
+  memset(bl->live, 0, bl->slots * sizeof(uint32_t));
+
+  for (i = num; i-- > 0;) {
+    const uint32_t slot =
+        fill[HASH_BIT_MODULO(HASH_KEY(hash, stride, i), mask, shift)]++;
+    bl->keys[slot] = HASH_KEY(key, stride, i);
+    bl->live[slot] = ~0u;
+    bl->slot[i] = slot;
+  }
+}
+
+void bin_layout_build(struct bin_layout *bl, struct scratch *s,
+                      const struct row_t *rel, uint64_t num, uint32_t mask,
+                      int shift, uint32_t bins, bool byIdx) {
+  layout(bl, s, (const char *)rel + offsetof(struct row_t, hashKey),
+         (const char *)rel + (byIdx ? offsetof(struct row_t, idx)
+                                    : offsetof(struct row_t, key)),
+         sizeof(struct row_t), num, mask, shift, bins);
+}
+
+void bin_layout_build_tags(struct bin_layout *bl, struct scratch *s,
+                           const struct tag_t *tags, uint64_t num,
+                           uint32_t mask, int shift, uint32_t bins) {
+  layout(bl, s, (const char *)tags + offsetof(struct tag_t, hashKey),
+         (const char *)tags + offsetof(struct tag_t, hashKey),
+         sizeof(struct tag_t), num, mask, shift, bins);
+}
@@ -0,0 +1,69 @@
+#ifndef BIN_LAYOUT_H
+#define BIN_LAYOUT_H
+
+#include "data-types.h"
+#include "scratch.h"
+#include <immintrin.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Bin layout of the build side of a join task, for the SIMD probes.
+ *
+ * Instead of chaining the rows of a Lemma-1 bin through next[], every bin is
+ * laid out as a contiguous run of slots, padded to a multiple of BIN_LANES
+ * and aligned so that the keys of BIN_LANES slots load as one AVX2 vector.
+ * A probe compares its row against every slot of its bin, BIN_LANES at a
+ * time, so the memory it touches depends on the bin only, never on which
+ * slots match. Padding slots are never live.
+ *
+ * The arrays live in the scratch arena of the thread, see scratch.h.
+ *
+ * Within a bin the rows are in decreasing row order, the order in which the
+ * chains used to be walked, so that blending the matches slot by slot keeps
+ * the last one as before.
+ */
+#define BIN_LANES 8
+
+struct bin_layout {
+  uint32_t *start; /* first slot of every bin, bins + 1 entries */
+  uint32_t *keys;  /* key (idx, hashKey) of every slot, 0 in padding */
+  uint32_t *live;  /* all ones for a row, 0 for padding */
+  uint32_t *slot;  /* slot of every row */
+  uint32_t slots;
+};
+
+/* most slots, and scratch room of bin_layout_build, for num rows in bins */
+uint32_t bin_layout_max_slots(uint64_t num, uint32_t bins);
+size_t bin_layout_room(uint64_t num, uint32_t bins);
+
+/* lays out rel[0 .. num) by bin (hashKey & mask) >> shift, keyed by the key
+   or, with byIdx, by the idx of the rows; the arrays are taken from s */
+void bin_layout_build(struct bin_layout *bl, struct scratch *s,
+                      const struct row_t *rel, uint64_t num, uint32_t mask,
+                      int shift, uint32_t bins, bool byIdx);
+
+/* the same for the tags of the counts join, keyed by their hashKey */
+void bin_layout_build_tags(struct bin_layout *bl, struct scratch *s,
+                           const struct tag_t *tags, uint64_t num,
+                           uint32_t mask, int shift, uint32_t bins);
+
+/* lanes of the 32-bit mask m that match key among slots s .. s + 7 */
+static inline __m256i bin_match(const struct bin_layout *bl, uint32_t s,
+                                __m256i key, __m256i m) {
+  const __m256i k = _mm256_load_si256((const __m256i *)(bl->keys + s));
+  const __m256i l = _mm256_load_si256((const __m256i *)(bl->live + s));
+  return _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi32(k, key), l), m);
+}
+
+/* lane j of the 32-bit mask m, broadcast to all 256 bits */
+static inline __m256i bin_lane(__m256i m, int j) {
+  return _mm256_permutevar8x32_epi32(m, _mm256_set1_epi32(j));
+}
+
+/* all ones if any lane of m is set, else 0 */
+static inline uint64_t bin_any(__m256i m) {
+  return -(uint64_t)!_mm256_testz_si256(m, m);
+}
+
+#endif /* BIN_LAYOUT_H */
@@ -49,6 +49,27 @@ struct table_t {
     //int sorted;
 };
 
+/*
+ * Tag of a row in the counts join (RHO), what its partitioning passes and
+ * join tasks move instead of the 32-byte row. The key is left out: hashKey is
+ * triple32 of the key, a bijection, so equal hashKeys mean equal keys. The
+ * cntExpand the join computes rides in the tag and is written back to the
+ * row by idx once the join is done.
+ */
+struct tag_t {
+    uint32_t hashKey;
+    uint32_t cntSelf;
+    uint32_t idx;
+    uint32_t cntExpand;
+} __attribute__((aligned(16)));
+
+#define TAG_IDX(T) ((T).idx)
+
+struct tag_table_t {
+    struct tag_t* tags;
+    uint64_t num_tags;
+};
+
 struct output_list_t {
     type_key key;
     type_value Rpayload;
@@ -83,6 +104,7 @@ struct result_t {
 struct join_result_t {
     uint64_t matches;
     uint64_t checksum;
+    uint64_t sum;
     uint64_t time_usec;
     uint64_t part_usec;
     uint64_t join_usec;
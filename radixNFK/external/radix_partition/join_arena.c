@@ -0,0 +1,95 @@
+#include "join_arena.h"
+#include "prj_params.h"
+#include "util.h"
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* at most this many joins run at once */
+#define MAX_SETS 8
+
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct join_buffers sets[MAX_SETS];
+static bool huge_pages = false;
+
+void join_arena_set_huge_pages(bool huge) { huge_pages = huge; }
+
+bool join_arena_huge_pages(void) { return huge_pages; }
+
+static void *alloc_buffer(size_t bytes) {
+  void *ret;
+  if (huge_pages) {
+    bytes = (bytes + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    ret = memalign(HUGE_PAGE_SIZE, bytes);
+    malloc_check(ret);
+    /* only a hint: without THP the buffer keeps its 4 KiB pages */
+    madvise(ret, bytes, MADV_HUGEPAGE);
+  } else {
+    ret = memalign(CACHE_LINE_SIZE, bytes);
+    malloc_check(ret);
+  }
+  return ret;
+}
+
+static void free_set(struct join_buffers *b) {
+  free(b->tmpR);
+  free(b->tmpS);
+  free(b->tmpR2);
+  free(b->tmpS2);
+  b->tmpR = b->tmpS = b->tmpR2 = b->tmpS2 = NULL;
+  b->bytes = 0;
+}
+
+/* the smallest set that fits bytes, else the largest one */
+static bool better_fit(const struct join_buffers *c,
+                       const struct join_buffers *b, size_t bytes) {
+  if (c->bytes >= bytes)
+    return b->bytes < bytes || c->bytes < b->bytes;
+  return c->bytes > b->bytes;
+}
+
+struct join_buffers *join_arena_acquire(size_t bytesR, size_t bytesS) {
+  const size_t bytes = bytesR > bytesS ? bytesR : bytesS;
+  struct join_buffers *b = NULL;
+  int i;
+
+  pthread_mutex_lock(&arena_lock);
+  for (i = 0; i < MAX_SETS; i++)
+    if (!sets[i].busy && (!b || better_fit(&sets[i], b, bytes)))
+      b = &sets[i];
+  if (!b) {
+    printf("join arena: more than %d joins at once\n", MAX_SETS);
+    exit(EXIT_FAILURE);
+  }
+  b->busy = true;
+  pthread_mutex_unlock(&arena_lock);
+
+  if (b->bytes < bytes) {
+    free_set(b);
+    b->tmpR = alloc_buffer(bytes);
+    b->tmpS = alloc_buffer(bytes);
+    b->tmpR2 = alloc_buffer(bytes);
+    b->tmpS2 = alloc_buffer(bytes);
+    b->bytes = bytes;
+  }
+  return b;
+}
+
+void join_arena_return(struct join_buffers *buffers) {
+  pthread_mutex_lock(&arena_lock);
+  buffers->busy = false;
+  pthread_mutex_unlock(&arena_lock);
+}
+
+void join_arena_release(void) {
+  int i;
+  pthread_mutex_lock(&arena_lock);
+  for (i = 0; i < MAX_SETS; i++)
+    if (!sets[i].busy)
+      free_set(&sets[i]);
+  pthread_mutex_unlock(&arena_lock);
+}
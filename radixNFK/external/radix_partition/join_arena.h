@@ -0,0 +1,40 @@
+#ifndef JOIN_ARENA_H
+#define JOIN_ARENA_H
+
+#include "data-types.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Partition buffers of the radix joins, kept for the whole process.
+ *
+ * Every RHO and RHO_idx call partitions into four relation-sized buffers,
+ * two for R and two for S. Instead of allocating and page-faulting them per
+ * call, join_init_run takes a set of buffers from this arena and returns it
+ * at the end. All four buffers of a set have the size of the largest
+ * relation the set has served, as R and S swap roles between calls, and a
+ * set only grows, so its pages stay mapped and faulted from one call to the
+ * next (pages past the relations of a call are never touched). Calls that
+ * run at the same time (the two index joins of radixNFK) get different sets.
+ *
+ * With join_arena_set_huge_pages the buffers are 2 MiB aligned and advised
+ * as transparent huge pages, which saves the scatter most of its TLB misses.
+ */
+struct join_buffers {
+  void *tmpR, *tmpS, *tmpR2, *tmpS2; /* of rows (RHO_idx) or tags (RHO) */
+  size_t bytes; /* of each buffer */
+  bool busy;
+};
+
+/* whether new buffers are backed by huge pages, false unless set */
+void join_arena_set_huge_pages(bool huge);
+bool join_arena_huge_pages(void);
+
+/* a free set with room for bytesR of R and bytesS of S */
+struct join_buffers *join_arena_acquire(size_t bytesR, size_t bytesS);
+void join_arena_return(struct join_buffers *buffers);
+
+/* frees every set; no join may be running */
+void join_arena_release(void);
+
+#endif /* JOIN_ARENA_H */
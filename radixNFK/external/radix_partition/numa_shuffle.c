@@ -0,0 +1,75 @@
+#include "numa_shuffle.h"
+#include <stdint.h>
+#include <unistd.h>
+
+static enum numa_strategy_t shuffle_strategy = RING;
+
+void numa_set_shuffle_strategy(enum numa_strategy_t strategy)
+{
+    shuffle_strategy = strategy;
+}
+
+enum numa_strategy_t numa_shuffle_strategy(void)
+{
+    return shuffle_strategy;
+}
+
+void numa_shuffle_order(int my_tid, int my_node, int num_nodes, int *order)
+{
+    int k;
+    switch (shuffle_strategy) {
+    case RANDOM: {
+        /* Fisher-Yates with a per-thread xorshift stream */
+        uint64_t x = 0x9e3779b97f4a7c15ULL * (uint64_t)(my_tid + 1);
+        for (k = 0; k < num_nodes; k++)
+            order[k] = k;
+        for (k = num_nodes - 1; k > 0; k--) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            int j = (int)(x % (uint64_t)(k + 1));
+            int tmp = order[k];
+            order[k] = order[j];
+            order[j] = tmp;
+        }
+        break;
+    }
+    case NEXT:
+        for (k = 0; k < num_nodes; k++)
+            order[k] = (my_tid + k) % num_nodes;
+        break;
+    case RING:
+    default:
+        for (k = 0; k < num_nodes; k++)
+            order[k] = (my_node + k) % num_nodes;
+        break;
+    }
+}
+
+static size_t share_bytes(size_t bytes, int nthreads)
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t share = (bytes + nthreads - 1) / nthreads;
+    return (share + page - 1) / page * page;
+}
+
+void numa_first_touch(void *buf, size_t bytes, int my_tid, int nthreads)
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t share = share_bytes(bytes, nthreads);
+    /* shares are page-aligned relative to buf; the first page may be shared
+       with whatever precedes buf, which is harmless */
+    size_t begin = (size_t)my_tid * share;
+    size_t end = begin + share;
+    if (end > bytes)
+        end = bytes;
+    volatile char *p = (volatile char *)buf;
+    for (size_t off = begin; off < end; off += page)
+        p[off] = 0;
+}
+
+int numa_share_owner(size_t offset, size_t bytes, int nthreads)
+{
+    size_t owner = offset / share_bytes(bytes, nthreads);
+    return owner < (size_t)nthreads ? (int)owner : nthreads - 1;
+}
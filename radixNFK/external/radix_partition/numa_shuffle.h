@@ -0,0 +1,34 @@
+#ifndef NUMA_SHUFFLE_H
+#define NUMA_SHUFFLE_H
+
+#include "data-types.h"
+#include <stddef.h>
+
+/*
+ * NUMA placement for the radix partitioning passes.
+ *
+ * The partition buffers are first-touched in equal, page-aligned shares, one
+ * per partitioning thread, so their pages end up on the threads' nodes. With
+ * more than one node, the pass-1 scatter then writes to one node at a time in
+ * the order given by the shuffling strategy [CIDR'13], so that the threads do
+ * not all write to the same remote node at once:
+ *
+ *   RANDOM  every thread visits the nodes in its own random order
+ *   RING    every thread starts with its own node and walks the ring
+ *   NEXT    thread t starts with node t mod #nodes and walks the ring
+ */
+
+/* strategy of the pass-1 scatter, RING unless set */
+void numa_set_shuffle_strategy(enum numa_strategy_t strategy);
+enum numa_strategy_t numa_shuffle_strategy(void);
+
+/* order[k] is the node thread my_tid (on my_node) scatters to in round k */
+void numa_shuffle_order(int my_tid, int my_node, int num_nodes, int *order);
+
+/* writes to every page of thread my_tid's share of buf */
+void numa_first_touch(void *buf, size_t bytes, int my_tid, int nthreads);
+
+/* thread whose share of a bytes-long buffer holds byte offset */
+int numa_share_owner(size_t offset, size_t bytes, int nthreads);
+
+#endif /* NUMA_SHUFFLE_H */
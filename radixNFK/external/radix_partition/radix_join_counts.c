@@ -1,14 +1,20 @@
 #include "radix_join_counts.h"
-#include "barrier.h"
+#include "bin_layout.h"
 #include "data-types.h"
+#include "join_arena.h"
 #include "malloc.h"
+#include "numa_shuffle.h"
 #include "prj_params.h"
+#include "radix_scatter.h"
 #include "task_queue.h"
 #include "util.h"
+#include "worker_pool.h"
+#include "writeback.h"
 #include <math.h>
-#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define HASH_BIT_MODULO(K, MASK, NBITS) (((K) & MASK) >> NBITS)
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
@@ -28,34 +34,43 @@
 typedef struct arg_t_radix arg_t_radix;
 typedef struct part_t part_t;
 
-/** holds the arguments passed to each thread */
+/** holds the arguments passed to each thread, the partitions hold tags */
 struct arg_t_radix {
   int32_t **histR;
   struct row_t *relR;
-  struct row_t *tmpR;
+  struct tag_t *tmpR;
   int32_t **histS;
   struct row_t *relS;
-  struct row_t *tmpS;
+  struct tag_t *tmpS;
 
-  struct row_t *origRelR;
-  struct row_t *origRelS;
+  /* the tags of relR and relS before pass 1, in this thread's share of
+     tmpR2 and tmpS2, which pass 1 does not use */
+  struct tag_t *tagsR;
+  struct tag_t *tagsS;
 
-  struct row_t *tmpR2;
-  struct row_t *tmpS2;
+  /* write-back of the fields the join changes, NULL for an unchanged side */
+  struct writeback *wbR;
+  struct writeback *wbS;
+
+  struct tag_t *tmpR2;
+  struct tag_t *tmpS2;
 
   uint64_t numR;
   uint64_t numS;
   uint64_t totalR;
   uint64_t totalS;
 
-  task_queue_t *join_queue;
-  task_queue_t *part_queue;
+  /* queues[k]: partition pairs after pass k + 1, the last ones are joined */
+  task_queue_t **queues;
 
-  pthread_barrier_t *barrier;
+  worker_barrier_t *barrier;
   JoinFunction join_function;
   int64_t result;
   int32_t my_tid;
+  struct scratch *scratch; /* arena of the thread, see scratch.h */
   int nthreads;
+  struct radix_params params;
+  int32_t *nodes; /* NUMA node of every thread */
 
   /* stats about the thread */
   int32_t parts_processed;
@@ -67,7 +82,8 @@ struct arg_t_radix {
 /** holds arguments passed for partitioning */
 struct part_t {
   struct row_t *rel;
-  struct row_t *tmp;
+  struct tag_t *tags; /* of rel */
+  struct tag_t *tmp;
   int32_t **hist;
   int32_t *output;
   arg_t_radix *thrargs;
@@ -88,48 +104,69 @@ static void *alloc_aligned(size_t size) {
   return ret;
 }
 
-int64_t bucket_chaining_join(const struct table_t *const R,
-                             const struct table_t *const S,
-                             struct table_t *const tmpR,
-                             output_list_t **output) {
+int64_t bucket_chaining_join(const struct tag_table_t *const R,
+                             const struct tag_table_t *const S,
+                             struct tag_table_t *const tmpR,
+                             output_list_t **output, struct scratch *scratch,
+                             int radix_bits) {
   (void)(tmpR);
   (void)(output);
 
-  int *next, *bucket;
-  const uint64_t numR = R->num_tuples;
-  const uint64_t numS = S->num_tuples;
+  const uint64_t numR = R->num_tags;
+  const uint64_t numS = S->num_tags;
 
   uint32_t N = ceil(numS * 0.08);
   PREV_POW_2(N);
-  const uint32_t MASK = (N - 1) << (NUM_RADIX_BITS);
-
-  next = (int *)malloc(sizeof(int) * numR);
-  bucket = (int *)calloc(N, sizeof(int));
-
-  struct row_t *Rtuples = R->tuples;
-  for (uint32_t i = 0; i < numR;) {
-    uint32_t idx = HASH_BIT_MODULO(R->tuples[i].hashKey, MASK, NUM_RADIX_BITS);
-    next[i] = bucket[idx];
-    bucket[idx] = ++i; /* we start pos's from 1 instead of 0 */
+  const uint32_t MASK = (N - 1) << radix_bits;
+
+  struct bin_layout bl;
+  uint32_t *cntSelf, *cntExpand;
+
+  /* cntSelf and cntExpand of R by slot, cntExpand written back at the end */
+  struct tag_t *Rtags = R->tags;
+  const uint32_t maxSlots = bin_layout_max_slots(numR, N);
+  scratch_reset(scratch, bin_layout_room(numR, N) +
+                             2 * SCRATCH_ROOM(maxSlots * sizeof(uint32_t)));
+  bin_layout_build_tags(&bl, scratch, Rtags, numR, MASK, radix_bits, N);
+  cntSelf = (uint32_t *)scratch_alloc(scratch, bl.slots * sizeof(uint32_t));
+  cntExpand = (uint32_t *)scratch_alloc(scratch, bl.slots * sizeof(uint32_t));
+  memset(cntSelf, 0, bl.slots * sizeof(uint32_t));
+  memset(cntExpand, 0, bl.slots * sizeof(uint32_t));
+  for (uint32_t i = 0; i < numR; i++) {
+    cntSelf[bl.slot[i]] = Rtags[i].cntSelf;
+    cntExpand[bl.slot[i]] = Rtags[i].cntExpand;
+    bl.live[bl.slot[i]] &= -(uint32_t)(Rtags[i].cntSelf != 0);
   }
 
-  struct row_t *Stuples = S->tuples;
+  /* a live key is on a single row of each table, at most one slot matches */
+  struct tag_t *Stags = S->tags;
   for (uint32_t i = 0; i < numS; i++) {
-    uint32_t idx = HASH_BIT_MODULO(Stuples[i].hashKey, MASK, NUM_RADIX_BITS);
-    for (int hit = bucket[idx]; hit > 0; hit = next[hit - 1]) {
-      uint64_t match = -(Rtuples[hit - 1].cntSelf != 0) &
-                       -(Stuples[i].cntSelf != 0) &
-                       -(Rtuples[hit - 1].key == Stuples[i].key);
-      Rtuples[hit - 1].cntExpand =
-          (match & Stuples[i].cntSelf) | (~match & Rtuples[hit - 1].cntExpand);
-      Stuples[i].cntExpand =
-          (match & Rtuples[hit - 1].cntSelf) | (~match & Stuples[i].cntExpand);
+    uint32_t idx = HASH_BIT_MODULO(Stags[i].hashKey, MASK, radix_bits);
+    const __m256i key = _mm256_set1_epi32((int)Stags[i].hashKey);
+    const __m256i live = _mm256_set1_epi32(-(Stags[i].cntSelf != 0));
+    const __m256i cnt = _mm256_set1_epi32((int)Stags[i].cntSelf);
+    __m256i acc = _mm256_setzero_si256(), any = _mm256_setzero_si256();
+    for (uint32_t s = bl.start[idx]; s < bl.start[idx + 1]; s += BIN_LANES) {
+      const __m256i match = bin_match(&bl, s, key, live);
+      __m256i *dst = (__m256i *)(cntExpand + s);
+      _mm256_store_si256(dst,
+                         _mm256_blendv_epi8(_mm256_load_si256(dst), cnt, match));
+      acc = _mm256_or_si256(
+          acc, _mm256_and_si256(
+                   match, _mm256_load_si256((const __m256i *)(cntSelf + s))));
+      any = _mm256_or_si256(any, match);
     }
+    __m128i acc4 = _mm_or_si128(_mm256_castsi256_si128(acc),
+                                _mm256_extracti128_si256(acc, 1));
+    acc4 = _mm_or_si128(acc4, _mm_shuffle_epi32(acc4, 0x4e));
+    acc4 = _mm_or_si128(acc4, _mm_shuffle_epi32(acc4, 0xb1));
+    const uint32_t match = (uint32_t)bin_any(any);
+    Stags[i].cntExpand = (match & (uint32_t)_mm_cvtsi128_si32(acc4)) |
+                           (~match & Stags[i].cntExpand);
   }
 
-  /* clean up temp */
-  free(bucket);
-  free(next);
+  for (uint32_t i = 0; i < numR; i++)
+    Rtags[i].cntExpand = cntExpand[bl.slot[i]];
 
   return 0;
 }
@@ -148,10 +185,14 @@ int64_t bucket_chaining_join(const struct table_t *const R,
  * @param hist [out] number of tuples in each partition
  * @param R cluster bits
  * @param D radix bits per pass
+ * @param ids [tmp] room for the partition id of every input tuple
+ * @param padding tuples between clusters
  * @returns tuples per partition.
  */
-static void radix_cluster(struct table_t *outRel, struct table_t *inRel,
-                          int64_t *hist, int R, int D) {
+static void radix_cluster(struct tag_table_t *outRel,
+                          struct tag_table_t *inRel,
+                          uint32_t *hist, uint16_t *ids, int R, int D,
+                          uint32_t padding) {
   uint64_t i;
   uint32_t M = ((1 << D) - 1) << R;
   uint32_t offset;
@@ -163,75 +204,90 @@ static void radix_cluster(struct table_t *outRel, struct table_t *inRel,
   uint32_t dst[fanOut];
 
   /* count tuples per cluster */
-  for (i = 0; i < inRel->num_tuples; i++) {
-    uint64_t idx = HASH_BIT_MODULO(inRel->tuples[i].hashKey, M, R);
-    hist[idx]++;
-  }
+  radix_histogram_tags(inRel->tags, inRel->num_tags, M, R, ids, hist, fanOut);
   offset = 0;
   /* determine the start and end of each cluster depending on the counts. */
   for (i = 0; i < fanOut; i++) {
-    /* dst[i]      = outRel->tuples + offset; */
+    /* dst[i]      = outRel->tags + offset; */
     /* determine the beginning of each partitioning by adding some
        padding to avoid L1 conflict misses during scatter. */
-    dst[i] = (uint32_t)(offset + i * SMALL_PADDING_TUPLES);
+    dst[i] = (uint32_t)(offset + i * padding);
     offset += hist[i];
   }
 
   /* copy tuples to their corresponding clusters at appropriate offsets */
-  for (i = 0; i < inRel->num_tuples; i++) {
-    uint32_t idx = HASH_BIT_MODULO(inRel->tuples[i].hashKey, M, R);
-    outRel->tuples[dst[idx]] = inRel->tuples[i];
-    ++dst[idx];
-  }
+  radix_scatter_tags(outRel->tags, inRel->tags, ids, inRel->num_tags, dst,
+                     fanOut);
 }
 
 /**
  * This function implements the radix clustering of a given input
  * relations. The relations to be clustered are defined in task_t and after
- * clustering, each partition pair is added to the join_queue to be joined.
+ * clustering, each partition pair is added to out_queue, to be partitioned by
+ * the next pass or joined.
  *
  * @param task description of the relation to be partitioned
- * @param join_queue task queue to add join tasks after clustering
+ * @param out_queue task queue to add the partition pairs to
+ * @param padding tuples between the partitions, see radix_pass_padding
+ * @param scratch arena of the calling thread
  */
-static void serial_radix_partition(task_t *const task, task_queue_t *join_queue,
-                                   const int R, const int D) {
+static void serial_radix_partition(task_t *const task, task_queue_t *out_queue,
+                                   const int R, const int D,
+                                   const uint32_t padding,
+                                   struct scratch *scratch) {
   int i;
   uint64_t offsetR = 0, offsetS = 0;
-  const int fanOut = 1 << D; /*(NUM_RADIX_BITS / NUM_PASSES);*/
-  int64_t *outputR, *outputS;
-
-  outputR = (int64_t *)calloc(fanOut + 1, sizeof(int64_t));
-  outputS = (int64_t *)calloc(fanOut + 1, sizeof(int64_t));
+  const int fanOut = 1 << D;
+  const uint64_t numMax = MAX(task->tagR.num_tags, task->tagS.num_tags);
+  uint32_t *outputR, *outputS;
+  uint16_t *ids;
+
+  scratch_reset(scratch, 2 * SCRATCH_ROOM((fanOut + 1) * sizeof(uint32_t)) +
+                             SCRATCH_ROOM(numMax * sizeof(uint16_t)));
+  outputR = (uint32_t *)scratch_alloc(scratch, (fanOut + 1) * sizeof(uint32_t));
+  outputS = (uint32_t *)scratch_alloc(scratch, (fanOut + 1) * sizeof(uint32_t));
+  ids = (uint16_t *)scratch_alloc(scratch, numMax * sizeof(uint16_t));
+  memset(outputR, 0, (fanOut + 1) * sizeof(uint32_t));
+  memset(outputS, 0, (fanOut + 1) * sizeof(uint32_t));
   /* TODO: measure the effect of memset() */
   /* memset(outputR, 0, fanOut * sizeof(int32_t)); */
-  radix_cluster(&task->tmpR, &task->relR, outputR, R, D);
+  radix_cluster(&task->tagTmpR, &task->tagR, outputR, ids, R, D, padding);
 
   /* memset(outputS, 0, fanOut * sizeof(int32_t)); */
-  radix_cluster(&task->tmpS, &task->relS, outputS, R, D);
+  radix_cluster(&task->tagTmpS, &task->tagS, outputS, ids, R, D, padding);
 
   /* task_t t; */
   for (i = 0; i < fanOut; i++) {
     if (outputR[i] > 0 && outputS[i] > 0) {
-      task_t *t = task_queue_get_slot_atomic(join_queue);
-      t->relR.num_tuples = outputR[i];
-      t->relR.tuples = task->tmpR.tuples + offsetR + i * SMALL_PADDING_TUPLES;
-      t->tmpR.tuples = task->relR.tuples + offsetR + i * SMALL_PADDING_TUPLES;
+      task_t *t = task_queue_get_slot_atomic(out_queue);
+      t->tagR.num_tags = outputR[i];
+      t->tagR.tags = task->tagTmpR.tags + offsetR + i * padding;
+      t->tagTmpR.tags = task->tagR.tags + offsetR + i * padding;
       offsetR += outputR[i];
 
-      t->relS.num_tuples = outputS[i];
-      t->relS.tuples = task->tmpS.tuples + offsetS + i * SMALL_PADDING_TUPLES;
-      t->tmpS.tuples = task->relS.tuples + offsetS + i * SMALL_PADDING_TUPLES;
+      t->tagS.num_tags = outputS[i];
+      t->tagS.tags = task->tagTmpS.tags + offsetS + i * padding;
+      t->tagTmpS.tags = task->tagS.tags + offsetS + i * padding;
       offsetS += outputS[i];
 
-      /* task_queue_copy_atomic(join_queue, &t); */
-      task_queue_add_atomic(join_queue, t);
+      task_queue_add_atomic(out_queue, t);
     } else {
       offsetR += outputR[i];
       offsetS += outputS[i];
     }
   }
-  free(outputR);
-  free(outputS);
+}
+
+/* the tags of rel[0 .. num), see struct tag_t */
+static void make_tags(struct tag_t *tags, const struct row_t *rel,
+                      uint32_t num) {
+  uint32_t i;
+  for (i = 0; i < num; i++) {
+    tags[i].hashKey = rel[i].hashKey;
+    tags[i].cntSelf = rel[i].cntSelf;
+    tags[i].idx = rel[i].idx;
+    tags[i].cntExpand = rel[i].cntExpand;
+  }
 }
 
 /**
@@ -240,10 +296,12 @@ static void serial_radix_partition(task_t *const task, task_queue_t *join_queue,
  * re-ordering as described by Kim et al. Parallel partitioning method is
  * commonly used by all parallel radix join algorithms.
  *
+ * The rows are first turned into tags, and the tags are partitioned.
+ *
  * @param part description of the relation to be partitioned
  */
 static void parallel_radix_partition(part_t *const part) {
-  const struct row_t *rel = part->rel;
+  const struct tag_t *tags = part->tags;
   int32_t **hist = part->hist;
   int32_t *output = part->output;
 
@@ -265,18 +323,17 @@ static void parallel_radix_partition(part_t *const part) {
 
   int32_t sum = 0;
   uint32_t i, j;
-  int rv = 0;
 
-  int32_t dst[fanOut + 1];
+  uint32_t dst[fanOut + 1];
 
   /* compute local histogram for the assigned region of rel */
   /* compute histogram */
   int32_t *my_hist = hist[my_tid];
 
-  for (i = 0; i < size; i++) {
-    uint32_t idx = HASH_BIT_MODULO(rel[i].hashKey, MASK, R);
-    my_hist[idx]++;
-  }
+  uint16_t *ids = (uint16_t *)malloc(size * sizeof(uint16_t));
+  malloc_check(ids);
+  make_tags(part->tags, part->rel, size);
+  radix_histogram_tags(tags, size, MASK, R, ids, (uint32_t *)my_hist, fanOut);
 
   /* compute local prefix sum on hist */
   for (i = 0; i < fanOut; i++) {
@@ -285,7 +342,7 @@ static void parallel_radix_partition(part_t *const part) {
   }
 
   /* wait at a barrier until each thread complete histograms */
-  barrier_arrive(part->thrargs->barrier, rv);
+  worker_barrier_wait(part->thrargs->barrier);
 
   /* determine the start and end of each cluster */
   for (i = 0; i < my_tid; i++) {
@@ -303,14 +360,41 @@ static void parallel_radix_partition(part_t *const part) {
   }
   output[fanOut] = part->total_tuples + fanOut * padding; // PADDING_TUPLES;
 
-  struct row_t *tmp = part->tmp;
+  struct tag_t *tmp = part->tmp;
+
+  const int num_nodes = worker_pool_num_nodes();
+  if (num_nodes > 1) {
+    /* NUMA-aware shuffling: scatter to the partitions of one node at a time,
+       in the order of the shuffling strategy (see numa_shuffle.h) */
+    const size_t bytes =
+        part->total_tuples * sizeof(struct tag_t) +
+        radix_relation_padding(&part->thrargs->params);
+    const int32_t *nodes = part->thrargs->nodes;
+    int dst_node[fanOut];
+    int order[num_nodes];
+    int k;
+
+    for (i = 0; i < fanOut; i++)
+      dst_node[i] = nodes[numa_share_owner(output[i] * sizeof(struct tag_t),
+                                           bytes, nthreads)];
+    numa_shuffle_order(my_tid, nodes[my_tid], num_nodes, order);
+
+    for (k = 0; k < num_nodes; k++) {
+      for (i = 0; i < size; i++) {
+        uint32_t idx = ids[i];
+        if (dst_node[idx] == order[k]) {
+          tmp[dst[idx]] = tags[i];
+          ++dst[idx];
+        }
+      }
+    }
+    free(ids);
+    return;
+  }
 
   /* Copy tuples to their corresponding clusters */
-  for (i = 0; i < size; i++) {
-    uint32_t idx = HASH_BIT_MODULO(rel[i].hashKey, MASK, R);
-    tmp[dst[idx]] = rel[i];
-    ++dst[idx];
-  }
+  radix_scatter_tags(tmp, tags, ids, size, dst, fanOut);
+  free(ids);
 }
 
 /**
@@ -325,22 +409,18 @@ static void parallel_radix_partition(part_t *const part) {
 static void *prj_thread(void *param) {
   arg_t_radix *args = (arg_t_radix *)param;
   int32_t my_tid = args->my_tid;
+  args->scratch = scratch_self();
 
-  const int fanOut = 1 << (NUM_RADIX_BITS / NUM_PASSES);
-  const int R = (NUM_RADIX_BITS / NUM_PASSES);
-  const int D = (NUM_RADIX_BITS - (NUM_RADIX_BITS / NUM_PASSES));
-  const int thresh1 = (const int)(MAX((1 << D), (1 << R)) *
-                                  THRESHOLD1((unsigned long)args->nthreads));
+  const struct radix_params *params = &args->params;
+  const int fanOut = 1 << radix_pass_bits(params, 0);
 
   // if (args->my_tid == 0)
   // {
-  //     printf("NUM_PASSES=%d, RADIX_BITS=%d\n", NUM_PASSES, NUM_RADIX_BITS);
-  //     printf("fanOut = %d, R = %d, D = %d, thresh1 = %d\n", fanOut, R, D,
-  //     thresh1);
+  //   printf("passes=%d, radix bits=%d\n", params->passes, params->bits);
+  //   printf("fanOut = %d\n", fanOut);
   // }
   uint64_t results = 0;
-  int i;
-  int rv = 0;
+  int i, k;
 
   part_t part;
   task_t *task;
@@ -351,8 +431,8 @@ static void *prj_thread(void *param) {
   int32_t *outputS = (int32_t *)calloc((fanOut + 1), sizeof(int32_t));
   malloc_check((void *)(outputR && outputS));
 
-  part_queue = args->part_queue;
-  join_queue = args->join_queue;
+  part_queue = args->queues[0];
+  join_queue = args->queues[params->passes - 1];
 
   args->histR[my_tid] = (int32_t *)calloc(fanOut, sizeof(int32_t));
   args->histS[my_tid] = (int32_t *)calloc(fanOut, sizeof(int32_t));
@@ -361,17 +441,31 @@ static void *prj_thread(void *param) {
 
   args->parts_processed = 0;
 
+  /* place this thread's share of the partition buffers on its node */
+  args->nodes[my_tid] = worker_pool_node();
+  {
+    const size_t bytesR =
+        args->totalR * sizeof(struct tag_t) + radix_relation_padding(params);
+    const size_t bytesS =
+        args->totalS * sizeof(struct tag_t) + radix_relation_padding(params);
+    numa_first_touch(args->tmpR, bytesR, my_tid, args->nthreads);
+    numa_first_touch(args->tmpS, bytesS, my_tid, args->nthreads);
+    numa_first_touch(args->tmpR2, bytesR, my_tid, args->nthreads);
+    numa_first_touch(args->tmpS2, bytesS, my_tid, args->nthreads);
+  }
+
   /* wait at a barrier until each thread starts and then start the timer */
-  barrier_arrive(args->barrier, rv);
+  worker_barrier_wait(args->barrier);
 
   /********** 1st pass of multi-pass partitioning ************/
   part.R = 0;
-  part.D = NUM_RADIX_BITS / NUM_PASSES;
+  part.D = radix_pass_bits(params, 0);
   part.thrargs = args;
-  part.padding = PADDING_TUPLES;
+  part.padding = radix_pass_padding(params, 0);
 
   /* 1. partitioning for relation R */
   part.rel = args->relR;
+  part.tags = args->tagsR;
   part.tmp = args->tmpR;
   part.hist = args->histR;
   part.output = outputR;
@@ -383,6 +477,7 @@ static void *prj_thread(void *param) {
 
   /* 2. partitioning for relation S */
   part.rel = args->relS;
+  part.tags = args->tagsS;
   part.tmp = args->tmpS;
   part.hist = args->histS;
   part.output = outputS;
@@ -393,26 +488,26 @@ static void *prj_thread(void *param) {
   parallel_radix_partition(&part);
 
   /* wait at a barrier until each thread copies out */
-  barrier_arrive(args->barrier, rv);
+  worker_barrier_wait(args->barrier);
 
   /********** end of 1st partitioning phase ******************/
 
-  /* 3. first thread creates partitioning tasks for 2nd pass */
+  /* 3. first thread creates partitioning tasks for 2nd pass (or join tasks) */
   if (my_tid == 0) {
     for (i = 0; i < fanOut; i++) {
-      int32_t ntupR = outputR[i + 1] - outputR[i] - (int32_t)PADDING_TUPLES;
-      int32_t ntupS = outputS[i + 1] - outputS[i] - (int32_t)PADDING_TUPLES;
+      int32_t ntupR = outputR[i + 1] - outputR[i] - (int32_t)part.padding;
+      int32_t ntupS = outputS[i + 1] - outputS[i] - (int32_t)part.padding;
 
       if (ntupR > 0 && ntupS > 0) {
         task_t *t = task_queue_get_slot(part_queue);
 
-        t->relR.num_tuples = t->tmpR.num_tuples = ntupR;
-        t->relR.tuples = args->tmpR + outputR[i];
-        t->tmpR.tuples = args->tmpR2 + outputR[i];
+        t->tagR.num_tags = t->tagTmpR.num_tags = ntupR;
+        t->tagR.tags = args->tmpR + outputR[i];
+        t->tagTmpR.tags = args->tmpR2 + outputR[i];
 
-        t->relS.num_tuples = t->tmpS.num_tuples = ntupS;
-        t->relS.tuples = args->tmpS + outputS[i];
-        t->tmpS.tuples = args->tmpS2 + outputS[i];
+        t->tagS.num_tags = t->tagTmpS.num_tags = ntupS;
+        t->tagS.tags = args->tmpS + outputS[i];
+        t->tagTmpS.tags = args->tmpS2 + outputS[i];
 
         task_queue_add(part_queue, t);
       }
@@ -423,34 +518,27 @@ static void *prj_thread(void *param) {
   }
 
   /* wait at a barrier until first thread adds all partitioning tasks */
-  barrier_arrive(args->barrier, rv);
-
-  /************ 2nd pass of multi-pass partitioning ********************/
-  /* 4. now each thread further partitions and add to join task queue **/
-
-#if NUM_PASSES == 1
-  /* If the partitioning is single pass we directly add tasks from pass-1 */
-  task_queue_t *swap = join_queue;
-  join_queue = part_queue;
-  /* part_queue is used as a temporary queue for handling skewed parts */
-  part_queue = swap;
-
-#elif NUM_PASSES == 2
+  worker_barrier_wait(args->barrier);
+
+  /************ further passes of multi-pass partitioning ********************/
+  /* 4. pass k + 1 partitions the pairs of pass k as parallel tasks, the last
+        pass adds them to the join task queue */
+  for (k = 1; k < params->passes; k++) {
+    while ((task = task_queue_get_atomic(args->queues[k - 1]))) {
+      serial_radix_partition(task, args->queues[k],
+                             radix_pass_shift(params, k),
+                             radix_pass_bits(params, k),
+                             radix_pass_padding(params, k),
+                             args->scratch);
+    }
 
-  while ((task = task_queue_get_atomic(part_queue))) {
-    serial_radix_partition(task, join_queue, R, D);
+    /* wait at a barrier until all threads add all tasks of this pass */
+    worker_barrier_wait(args->barrier);
   }
 
-#else
-#warning Only 2-pass partitioning is implemented, set NUM_PASSES to 2!
-#endif
-
   free(outputR);
   free(outputS);
 
-  /* wait at a barrier until all threads add all join tasks */
-  barrier_arrive(args->barrier, rv);
-
   // if(my_tid == 0)
   // {
   //     printf("Number of join tasks = %d\n", join_queue->count);
@@ -463,35 +551,36 @@ static void *prj_thread(void *param) {
     //    i.e. bucket chaining, histogram-based, histogram-based with simd &
     //    prefetching  */
     results +=
-        args->join_function(&task->relR, &task->relS, &task->tmpR, &output);
-
-    /* Propagate changes back to original data using idx mapping */
-    for (uint32_t i = 0; i < task->relR.num_tuples; i++) {
-      uint32_t orig_idx = task->relR.tuples[i].idx;
-      if (orig_idx >= args->totalR) {
-        printf("ERROR: orig_idx %u out of bounds for R (size %lu)\n", orig_idx,
-               args->totalR);
-        exit(1);
-      }
-      args->origRelR[orig_idx].cntExpand = task->relR.tuples[i].cntExpand;
-    }
-    for (uint32_t i = 0; i < task->relS.num_tuples; i++) {
-      uint32_t orig_idx = task->relS.tuples[i].idx;
-      if (orig_idx >= args->totalS) {
-        printf("ERROR: orig_idx %u out of bounds for S (size %lu)\n", orig_idx,
-               args->totalS);
-        exit(1);
-      }
-      args->origRelS[orig_idx].cntExpand = task->relS.tuples[i].cntExpand;
-    }
+        args->join_function(&task->tagR, &task->tagS, &task->tagTmpR, &output,
+                            args->scratch, params->bits);
+
     args->parts_processed++;
   }
 
+  /* once all tasks are joined, write the changed fields of the tags back to
+     the original rows, see writeback.h */
+  worker_barrier_wait(args->barrier);
+  if (args->wbR)
+    writeback_collect(args->wbR, my_tid, join_queue->tasks, join_queue->count,
+                      0);
+  if (args->wbS)
+    writeback_collect(args->wbS, my_tid, join_queue->tasks, join_queue->count,
+                      1);
+  worker_barrier_wait(args->barrier);
+  if (args->wbR)
+    writeback_apply(args->wbR);
+  if (args->wbS)
+    writeback_apply(args->wbS);
+
   args->result = results;
-  barrier_arrive(args->barrier, rv);
+  worker_barrier_wait(args->barrier);
   return 0;
 }
 
+static void prj_lane(void *param, int i) {
+  prj_thread(&((arg_t_radix *)param)[i]);
+}
+
 /**
  * The template function for different joins: Basically each parallel radix join
  * has a initialization step, partitioning step and build-probe steps. All our
@@ -506,46 +595,52 @@ static void *prj_thread(void *param) {
  * histogram_optimized_join()
  */
 static result_t *join_init_run(struct table_t *relR, struct table_t *relS,
-                               JoinFunction jf, int nthreads) {
-  int i, rv;
-  pthread_t tid[nthreads];
-  pthread_barrier_t barrier;
+                               JoinFunction jf, int nthreads,
+                               const struct radix_params *params) {
+  int i;
+  worker_barrier_t barrier;
+
+  /* the threads meet at barriers, so all of them must run at once */
+  if (nthreads > worker_pool_team_size())
+    nthreads = worker_pool_team_size();
 
   arg_t_radix args[nthreads];
+  int32_t nodes[nthreads];
 
   int32_t **histR, **histS;
-  struct row_t *tmpRelR, *tmpRelS;
-  struct row_t *tmpRelR2, *tmpRelS2;
+  struct join_buffers *buffers;
+  struct writeback writeback[2], *wbR = &writeback[0], *wbS = &writeback[1];
   uint64_t numperthr[2];
   int64_t result = 0;
 
-  task_queue_t *part_queue, *join_queue;
-
-  part_queue = task_queue_init(FANOUT_PASS1);
-  join_queue = task_queue_init((1 << NUM_RADIX_BITS));
+  task_queue_t *queues[RADIX_MAX_PASSES];
+  const size_t relation_padding = radix_relation_padding(params);
 
-  /* allocate temporary space for partitioning */
-  tmpRelR = (struct row_t *)alloc_aligned(
-      relR->num_tuples * sizeof(struct row_t) + RELATION_PADDING);
-  tmpRelS = (struct row_t *)alloc_aligned(
-      relS->num_tuples * sizeof(struct row_t) + RELATION_PADDING);
-  malloc_check((void *)(tmpRelR && tmpRelS));
+  /* after pass k + 1 there are at most 2^(bits of passes 1 .. k + 1) pairs */
+  for (i = 0; i < params->passes; i++)
+    queues[i] = task_queue_init(
+        1 << (radix_pass_shift(params, i) + radix_pass_bits(params, i)));
 
-  tmpRelR2 = (struct row_t *)alloc_aligned(
-      relR->num_tuples * sizeof(struct row_t) + RELATION_PADDING);
-  tmpRelS2 = (struct row_t *)alloc_aligned(
-      relS->num_tuples * sizeof(struct row_t) + RELATION_PADDING);
+  /* temporary space for partitioning the tags, kept from one join to the
+     next */
+  buffers = join_arena_acquire(
+      relR->num_tuples * sizeof(struct tag_t) + relation_padding,
+      relS->num_tuples * sizeof(struct tag_t) + relation_padding);
 
   /* allocate histograms arrays, actual allocation is local to threads */
   histR = (int32_t **)alloc_aligned(nthreads * sizeof(int32_t *));
   histS = (int32_t **)alloc_aligned(nthreads * sizeof(int32_t *));
   malloc_check((void *)(histR && histS));
 
-  rv = pthread_barrier_init(&barrier, NULL, nthreads);
-  if (rv != 0) {
-    printf("Couldn't create the barrier\n");
-    exit(EXIT_FAILURE);
-  }
+  /* the join changes cntExpand of both sides */
+  writeback_init(wbR, relR->tuples, relR->num_tuples,
+                 offsetof(struct row_t, cntExpand),
+                 offsetof(struct tag_t, cntExpand), sizeof(uint32_t), nthreads);
+  writeback_init(wbS, relS->tuples, relS->num_tuples,
+                 offsetof(struct row_t, cntExpand),
+                 offsetof(struct tag_t, cntExpand), sizeof(uint32_t), nthreads);
+
+  worker_barrier_init(&barrier, nthreads);
 
   /* first assign chunks of relR & relS for each thread */
   numperthr[0] = relR->num_tuples / nthreads;
@@ -557,18 +652,19 @@ static result_t *join_init_run(struct table_t *relR, struct table_t *relS,
       (threadresult_t *)malloc(sizeof(threadresult_t) * nthreads);
   for (i = 0; i < nthreads; i++) {
     args[i].relR = relR->tuples + i * numperthr[0];
-    args[i].tmpR = tmpRelR;
+    args[i].tmpR = buffers->tmpR;
     args[i].histR = histR;
 
     args[i].relS = relS->tuples + i * numperthr[1];
-    args[i].tmpS = tmpRelS;
+    args[i].tmpS = buffers->tmpS;
     args[i].histS = histS;
 
-    /* Store original array pointers for propagation */
-    args[i].origRelR = relR->tuples;
-    args[i].origRelS = relS->tuples;
-    args[i].tmpR2 = tmpRelR2;
-    args[i].tmpS2 = tmpRelS2;
+    args[i].wbR = wbR;
+    args[i].wbS = wbS;
+    args[i].tmpR2 = buffers->tmpR2;
+    args[i].tmpS2 = buffers->tmpS2;
+    args[i].tagsR = args[i].tmpR2 + i * numperthr[0];
+    args[i].tagsS = args[i].tmpS2 + i * numperthr[1];
 
     args[i].numR = (i == (nthreads - 1)) ? (relR->num_tuples - i * numperthr[0])
                                          : numperthr[0];
@@ -578,26 +674,19 @@ static result_t *join_init_run(struct table_t *relR, struct table_t *relS,
     args[i].totalS = relS->num_tuples;
 
     args[i].my_tid = i;
-    args[i].part_queue = part_queue;
-    args[i].join_queue = join_queue;
+    args[i].queues = queues;
 
     args[i].barrier = &barrier;
+    args[i].nodes = nodes;
     args[i].join_function = jf;
     args[i].nthreads = nthreads;
-
-    rv = pthread_create(&tid[i], NULL, prj_thread, (void *)&args[i]);
-
-    if (rv) {
-      printf("return code from pthread_create() is %d\n", rv);
-      exit(EXIT_FAILURE);
-    }
+    args[i].params = *params;
   }
 
-  /* wait for threads to finish */
-  for (i = 0; i < nthreads; i++) {
-    pthread_join(tid[i], NULL);
+  /* run the threads on the worker pool and wait for them to finish */
+  worker_pool_run(nthreads, prj_lane, args);
+  for (i = 0; i < nthreads; i++)
     result += args[i].result;
-  }
 
   joinresult->totalresults = result;
   joinresult->nthreads = nthreads;
@@ -611,30 +700,20 @@ static result_t *join_init_run(struct table_t *relR, struct table_t *relS,
   free(histS);
 
   /* Clean up task queues more carefully */
-  if (part_queue) {
-    task_queue_free(part_queue);
-  }
-  if (join_queue) {
-    task_queue_free(join_queue);
-  }
-
-  if (tmpRelR) {
-    free(tmpRelR);
-  }
-  if (tmpRelS) {
-    free(tmpRelS);
+  for (i = 0; i < params->passes; i++) {
+    if (queues[i]) {
+      task_queue_free(queues[i]);
+    }
   }
 
-  if (tmpRelR2) {
-    free(tmpRelR2);
-  }
-  if (tmpRelS2) {
-    free(tmpRelS2);
-  }
+  join_arena_return(buffers);
+  writeback_free(wbR);
+  writeback_free(wbS);
 
   return joinresult;
 }
 
-result_t *RHO(struct table_t *relR, struct table_t *relS, int nthreads) {
-  return join_init_run(relR, relS, bucket_chaining_join, nthreads);
+result_t *RHO(struct table_t *relR, struct table_t *relS, int nthreads,
+              const struct radix_params *params) {
+  return join_init_run(relR, relS, bucket_chaining_join, nthreads, params);
 }
@@ -0,0 +1,64 @@
+#ifndef RADIX_SCATTER_H
+#define RADIX_SCATTER_H
+
+#include "data-types.h"
+#include <stdint.h>
+
+/*
+ * Histogram and scatter steps of the radix partitioning.
+ *
+ * radix_histogram computes the partition id of every tuple of a run once,
+ * (hashKey & mask) >> shift, into ids[] and counts the tuples per partition.
+ * With AVX2 it computes the ids of 8 tuples at once and spreads the counts
+ * over 4 copies of the histogram, so that runs of equal ids do not wait on
+ * each other's increments.
+ *
+ * The scatter then copies every tuple to the next free slot of its partition,
+ * reusing the ids:
+ *
+ *   DIRECT  one store per tuple straight into the partition
+ *   SWWC    software write-combining: the tuples of a partition are gathered
+ *           in a cache-line buffer that stays in L1, and every full line is
+ *           written with non-temporal stores, so the scatter neither reads
+ *           the destination lines nor pulls them into the caches. A line
+ *           that is shared with the partition of another thread (the first
+ *           and last line of a run) is written with ordinary stores.
+ *
+ * The slot of tuple i is out[dst[ids[i]]], after which dst[ids[i]] is
+ * incremented. Fan-outs are at most 2^16, see RADIX_MAX_PASS_BITS.
+ *
+ * The _tags versions do the same on the 16-byte tags of the counts join, see
+ * struct tag_t.
+ */
+enum radix_scatter_t { SCATTER_DIRECT, SCATTER_SWWC };
+
+/* scatter used by the partitioning passes, DIRECT unless set */
+void radix_set_scatter(enum radix_scatter_t scatter);
+enum radix_scatter_t radix_scatter_mode(void);
+
+/* partition ids of rel[0 .. num) into ids, their counts added to hist */
+void radix_histogram(const struct row_t *rel, uint64_t num, uint32_t mask,
+                     int shift, uint16_t *ids, uint32_t *hist,
+                     uint32_t fanOut);
+
+void radix_histogram_tags(const struct tag_t *tags, uint64_t num,
+                          uint32_t mask, int shift, uint16_t *ids,
+                          uint32_t *hist, uint32_t fanOut);
+
+/* scatters rel[0 .. num) with the current scatter */
+void radix_scatter(struct row_t *out, const struct row_t *rel,
+                   const uint16_t *ids, uint64_t num, uint32_t *dst,
+                   uint32_t fanOut);
+
+void radix_scatter_direct(struct row_t *out, const struct row_t *rel,
+                          const uint16_t *ids, uint64_t num, uint32_t *dst);
+void radix_scatter_swwc(struct row_t *out, const struct row_t *rel,
+                        const uint16_t *ids, uint64_t num, uint32_t *dst,
+                        uint32_t fanOut);
+
+/* scatters tags[0 .. num) with the current scatter */
+void radix_scatter_tags(struct tag_t *out, const struct tag_t *tags,
+                        const uint16_t *ids, uint64_t num, uint32_t *dst,
+                        uint32_t fanOut);
+
+#endif /* RADIX_SCATTER_H */
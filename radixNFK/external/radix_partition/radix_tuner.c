@@ -0,0 +1,143 @@
+#include "radix_tuner.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Lemma 1 target probability and bins per partition the tuner keeps */
+#define TUNE_LEMMA1_P 0.001
+#define TUNE_MIN_BINS 16
+#define TUNE_TASKS_PER_THREAD 4
+/* second-level TLB entries for 4 KiB pages; partitions of a pass beyond this
+   miss the TLB on (nearly) every scattered tuple */
+#define TUNE_TLB_ENTRIES 1536
+
+/* a sysfs cache attribute, 0 if missing; sizes like "48K" are in bytes */
+static size_t read_cache_attr(int index, const char *attr) {
+  char path[128], buf[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/%s",
+           index, attr);
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return 0;
+  size_t v = 0;
+  if (fgets(buf, sizeof(buf), f)) {
+    char *end;
+    v = strtoull(buf, &end, 10);
+    if (*end == 'K')
+      v <<= 10;
+    else if (*end == 'M')
+      v <<= 20;
+  }
+  fclose(f);
+  return v;
+}
+
+static bool cache_is_data(int index) {
+  char path[128], buf[32] = "";
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  bool data = fgets(buf, sizeof(buf), f) && buf[0] != 'I'; /* not Instruction */
+  fclose(f);
+  return data;
+}
+
+void cache_geometry_detect(struct cache_geometry *geo) {
+  geo->line_size = 0;
+  geo->l1_size = 0;
+  geo->l1_assoc = 0;
+  geo->l2_size = 0;
+
+  for (int i = 0; i < 16; i++) {
+    size_t level = read_cache_attr(i, "level");
+    if (level == 0)
+      break;
+    if (!cache_is_data(i))
+      continue;
+    if (level == 1) {
+      geo->l1_size = read_cache_attr(i, "size");
+      geo->l1_assoc = read_cache_attr(i, "ways_of_associativity");
+      geo->line_size = read_cache_attr(i, "coherency_line_size");
+    } else if (level == 2) {
+      geo->l2_size = read_cache_attr(i, "size");
+    }
+  }
+
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+  long v;
+  if (!geo->l1_size && (v = sysconf(_SC_LEVEL1_DCACHE_SIZE)) > 0)
+    geo->l1_size = v;
+  if (!geo->l1_assoc && (v = sysconf(_SC_LEVEL1_DCACHE_ASSOC)) > 0)
+    geo->l1_assoc = v;
+  if (!geo->line_size && (v = sysconf(_SC_LEVEL1_DCACHE_LINESIZE)) > 0)
+    geo->line_size = v;
+  if (!geo->l2_size && (v = sysconf(_SC_LEVEL2_CACHE_SIZE)) > 0)
+    geo->l2_size = v;
+#endif
+
+  if (!geo->line_size)
+    geo->line_size = CACHE_LINE_SIZE;
+  if (!geo->l1_size)
+    geo->l1_size = L1_CACHE_SIZE;
+  if (!geo->l1_assoc)
+    geo->l1_assoc = L1_ASSOCIATIVITY;
+  if (!geo->l2_size)
+    geo->l2_size = L2_CACHE_SIZE;
+}
+
+struct radix_params radix_default_params(void) {
+  struct radix_params p = {NUM_RADIX_BITS, NUM_PASSES};
+  return p;
+}
+
+bool radix_params_valid(const struct radix_params *p) {
+  /* the last pass has the most bits */
+  return p->passes >= 1 && p->passes <= RADIX_MAX_PASSES &&
+         p->bits >= p->passes && p->bits <= RADIX_MAX_BITS &&
+         radix_pass_bits(p, p->passes - 1) <= RADIX_MAX_PASS_BITS;
+}
+
+struct radix_params radix_autotune(uint64_t numR, uint64_t numS, int nthreads,
+                                   const struct cache_geometry *geo) {
+  const uint64_t build = numR < numS ? numR : numS;
+  const uint64_t bytes = build * (sizeof(struct row_t) + 3 * sizeof(uint32_t));
+  struct radix_params p;
+  int bits = 1;
+
+  /* partitions of the build side fit half of L2 ... */
+  while ((bytes >> bits) > geo->l2_size / 2)
+    bits++;
+  /* ... and there are enough of them to keep every thread busy */
+  while (((uint64_t)1 << bits) < (uint64_t)TUNE_TASKS_PER_THREAD * nthreads)
+    bits++;
+
+  /* Lemma 1 needs n >= m ln(m / p) rows per partition for m bins */
+  const double min_rows =
+      TUNE_MIN_BINS * log(TUNE_MIN_BINS / TUNE_LEMMA1_P);
+  while (bits > 1 && (double)build / ((uint64_t)1 << bits) < min_rows)
+    bits--;
+  if (bits > RADIX_MAX_BITS)
+    bits = RADIX_MAX_BITS;
+
+  /* one write-combining line per partition of a pass fits L1, and a page per
+     partition fits the TLB */
+  int pass_bits = 0;
+  while (((size_t)2 << pass_bits) * geo->line_size <= geo->l1_size &&
+         (2 << pass_bits) <= TUNE_TLB_ENTRIES)
+    pass_bits++;
+  if (pass_bits > RADIX_MAX_PASS_BITS)
+    pass_bits = RADIX_MAX_PASS_BITS;
+  if (pass_bits < 1)
+    pass_bits = 1;
+
+  p.passes = (bits + pass_bits - 1) / pass_bits;
+  if (p.passes > RADIX_MAX_PASSES) {
+    p.passes = RADIX_MAX_PASSES;
+    bits = RADIX_MAX_PASSES * pass_bits;
+  }
+  p.bits = bits;
+  return p;
+}
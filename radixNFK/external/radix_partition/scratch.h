@@ -0,0 +1,42 @@
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include <stddef.h>
+
+/*
+ * Per-thread scratch memory of the partitioning and join tasks.
+ *
+ * Every worker thread owns one arena (scratch_self). A task resets it to the
+ * room it needs and carves its temporaries out of it with scratch_alloc;
+ * nothing is freed one by one. An arena only grows, so once the largest
+ * partition has passed through a thread it is not reallocated again, and it
+ * is kept across the RHO and RHO_idx calls of a query, until scratch_release.
+ */
+
+/** alignment of every scratch_alloc, one AVX2 vector */
+#define SCRATCH_ALIGN 32
+
+/** room that scratch_alloc takes for bytes */
+#define SCRATCH_ROOM(bytes)                                                    \
+  (((size_t)(bytes) + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1))
+
+struct scratch {
+  char *base;
+  size_t size;
+  size_t used;
+  int registered;
+};
+
+/* the arena of the calling thread */
+struct scratch *scratch_self(void);
+
+/* empties s and makes sure it has room for at least bytes */
+void scratch_reset(struct scratch *s, size_t bytes);
+
+/* SCRATCH_ROOM(bytes) of the room reserved by scratch_reset */
+void *scratch_alloc(struct scratch *s, size_t bytes);
+
+/* frees the arenas of all threads; no join may be running */
+void scratch_release(void);
+
+#endif /* SCRATCH_H */
@@ -1,17 +1,26 @@
 #ifndef INPUTS_H
 #define INPUTS_H
 
+#include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
+#include <fcntl.h>
 #include <immintrin.h>
 #include <iostream>
 #include <limits>
-#include <sstream>
 #include <string>
-#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
+#include "data-types.h"
+#include "parallel_for.h"
+#include "slice_utils.h"
+
 #define DATA_LENGTH 12
 
 struct Record {
@@ -52,103 +61,300 @@ inline void maskedCopyRecord32(const Record *src, Record *dst,
 #endif
 }
 
-// returns true if 's' is empty or contains only whitespace chars
-static bool is_blank_line(const std::string &s) {
-  for (char c : s) {
-    if (!std::isspace(static_cast<unsigned char>(c))) {
+// returns true if [b, e) is empty or contains only whitespace chars
+inline bool is_blank_line(const char *b, const char *e) {
+  for (; b != e; ++b) {
+    if (!std::isspace(static_cast<unsigned char>(*b)))
       return false;
-    }
   }
   return true;
 }
 
+// skips leading whitespace and parses one unsigned integer from [b, e)
+template <typename T>
+inline const char *parse_uint(const char *b, const char *e, T &out) {
+  while (b != e && std::isspace(static_cast<unsigned char>(*b)))
+    ++b;
+  auto [ptr, ec] = std::from_chars(b, e, out);
+  return ec == std::errc() ? ptr : nullptr;
+}
+
+// Fills one row from a non-blank data line [b, e): <key> <rest-of-line> where
+// the "rest-of-line" (minus a single leading space) goes into .pay,
+// truncated to DATA_LENGTH - 1 bytes.
+inline bool parse_record(const char *b, const char *e, std::uint32_t idx,
+                         row_t &rec) {
+  std::uint32_t key;
+  const char *rest = parse_uint(b, e, key);
+  if (!rest)
+    return false;
+  if (rest != e && *rest == ' ')
+    ++rest;
+
+  rec.key = key;
+  rec.cntSelf = 0;
+  rec.cntExpand = 0;
+  rec.hashKey = 0;
+  rec.idx = idx;
+
+  std::memset(rec.pay, 0, DATA_LENGTH);
+  const char *nul = static_cast<const char *>(std::memchr(rest, '\0', e - rest));
+  size_t copy_len = std::min(static_cast<size_t>((nul ? nul : e) - rest),
+                             static_cast<size_t>(DATA_LENGTH - 1));
+  std::memcpy(rec.pay, rest, copy_len);
+  return true;
+}
+
+// Faults in the pages of tuples[0, n) writable from numThreads threads, thread
+// t taking the rows of buildSlices(n, numThreads)[t]. The pipeline stages use
+// the same slices, so first-touch placement puts every page on the node of the
+// thread that works on it. On a MAP_PRIVATE file mapping this also breaks
+// copy-on-write up front, so only the private copy stays resident.
+inline void populate_table_slice(row_t *tuples, std::uint64_t n,
+                                 const Slice &sl) {
+  const std::uintptr_t page =
+      static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+  const std::uintptr_t lo = reinterpret_cast<std::uintptr_t>(tuples);
+  const std::uintptr_t hi = reinterpret_cast<std::uintptr_t>(tuples + n);
+  // every page goes to the slice holding its first byte
+  std::uintptr_t b =
+      reinterpret_cast<std::uintptr_t>(tuples + sl.begin) & ~(page - 1);
+  std::uintptr_t e =
+      reinterpret_cast<std::uintptr_t>(tuples + sl.end) & ~(page - 1);
+  if (sl.begin == 0)
+    b = lo & ~(page - 1);
+  if (sl.end == n)
+    e = (hi + page - 1) & ~(page - 1);
+  if (b >= e)
+    return;
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(reinterpret_cast<void *>(b), e - b, MADV_POPULATE_WRITE) == 0)
+    return;
+#endif
+  // older kernels: touch one byte per page, clipped to the table
+  for (std::uintptr_t p = std::max(b, lo); p < std::min(e, hi);
+       p = (p | (page - 1)) + 1) {
+    volatile char *c = reinterpret_cast<volatile char *>(p);
+    *c = *c;
+  }
+}
+
+inline void populate_two_tables(table_t &table0, table_t &table1,
+                                unsigned numThreads) {
+  std::vector<Slice> sl0, sl1;
+  if (table0.num_tuples)
+    sl0 = buildSlices(table0.num_tuples, numThreads);
+  if (table1.num_tuples)
+    sl1 = buildSlices(table1.num_tuples, numThreads);
+  parallelFor(std::max(sl0.size(), sl1.size()), [&](size_t t) {
+    if (t < sl0.size())
+      populate_table_slice(table0.tuples, table0.num_tuples, sl0[t]);
+    if (t < sl1.size())
+      populate_table_slice(table1.tuples, table1.num_tuples, sl1[t]);
+  });
+}
+
+// Zeroes a table slice by slice on the worker pool, so that its pages are
+// first-touched (and placed on the NUMA node of) the workers that go on to
+// process those slices.
+inline void clear_table_parallel(table_t &table,
+                                 const std::vector<Slice> &slices) {
+  parallelFor(slices.size(), [&](size_t t) {
+    std::memset(table.tuples + slices[t].begin, 0,
+                (slices[t].end - slices[t].begin) * sizeof(row_t));
+  });
+}
+
+// Drops the whole pages of [from, to) from a read-only file mapping. They stay
+// in the page cache, so a later read only takes a minor fault, but they no
+// longer count towards our resident set.
+inline void release_mapped_pages(const char *from, const char *to) {
+  const std::uintptr_t page =
+      static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+  std::uintptr_t b =
+      (reinterpret_cast<std::uintptr_t>(from) + page - 1) & ~(page - 1);
+  std::uintptr_t e = reinterpret_cast<std::uintptr_t>(to) & ~(page - 1);
+  if (b < e)
+    madvise(reinterpret_cast<void *>(b), e - b, MADV_DONTNEED);
+}
+
 // Reads two tables from a file whose first non-empty line is: n0 n1
 // (any number of blank lines are skipped), then exactly n0 + n1 data lines:
 // <key> <rest-of-line> where the "rest-of-line" (including spaces) goes into
-// .paySelf.
-inline bool load_two_tables(const std::string &input_path,
-                            std::vector<Record> &table0,
-                            std::vector<Record> &table1) {
-  std::ifstream in(input_path);
-  if (!in) {
+// .pay.
+//
+// The file is memory-mapped and the body is cut into newline-aligned chunks.
+// A first parallel pass counts the data lines of each chunk, the prefix sum of
+// those counts gives every chunk the index of its first record, and a second
+// parallel pass parses the records straight into the 32-byte aligned row_t
+// arrays of table0/table1. Records get the same .idx as a sequential read.
+//
+// The tables are faulted in by populate_two_tables before parsing, and both
+// passes hand the text pages they are done with back to the page cache, so
+// the resident set never holds much more than one copy of the input.
+inline bool load_two_tables(const std::string &input_path, table_t &table0,
+                            table_t &table1, unsigned numThreads) {
+  table0 = table_t{};
+  table1 = table_t{};
+
+  int fd = open(input_path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
     std::cerr << "Error: cannot open \"" << input_path << "\"\n";
+    if (fd >= 0)
+      close(fd);
     return false;
   }
+  const size_t fileLen = static_cast<size_t>(st.st_size);
+  const char *base = nullptr;
+  if (fileLen > 0) {
+    void *map = mmap(nullptr, fileLen, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      std::cerr << "Error: cannot map \"" << input_path << "\"\n";
+      close(fd);
+      return false;
+    }
+    base = static_cast<const char *>(map);
+    /* advice values are not flags, each needs its own call */
+    madvise(map, fileLen, MADV_SEQUENTIAL);
+    madvise(map, fileLen, MADV_WILLNEED);
+  }
+  close(fd);
+
+  const char *const fileEnd = base + fileLen;
+  auto lineEnd = [fileEnd](const char *p) {
+    const char *nl =
+        static_cast<const char *>(std::memchr(p, '\n', fileEnd - p));
+    return nl ? nl : fileEnd;
+  };
+  auto unmap = [&] {
+    if (base)
+      munmap(const_cast<char *>(base), fileLen);
+  };
 
   // --- 1) read header, skipping any blank lines ---
   size_t n0 = 0, n1 = 0;
-  {
-    std::string header_line;
-    while (std::getline(in, header_line)) {
-      if (is_blank_line(header_line))
-        continue;
-      std::istringstream hdr(header_line);
-      if (!(hdr >> n0 >> n1)) {
-        std::cerr << "Error: malformed header: \"" << header_line << "\"\n";
-        return false;
-      }
-      break;
+  const char *body = base;
+  while (body < fileEnd) {
+    const char *e = lineEnd(body);
+    const char *line = body;
+    body = (e == fileEnd) ? fileEnd : e + 1;
+    if (is_blank_line(line, e))
+      continue;
+    const char *p = parse_uint(line, e, n0);
+    if (!p || !parse_uint(p, e, n1)) {
+      std::cerr << "Error: malformed header: \"" << std::string(line, e)
+                << "\"\n";
+      unmap();
+      return false;
     }
+    break;
+  }
+  const size_t total = n0 + n1;
+
+  // --- 2) split the body into newline-aligned chunks ---
+  constexpr size_t minChunkBytes = 1 << 20;
+  constexpr std::ptrdiff_t releaseBytes = 1 << 20;
+  const size_t bodyLen = fileEnd - body;
+  size_t P = std::max<size_t>(1, numThreads);
+  P = std::max<size_t>(1, std::min(P, bodyLen / minChunkBytes));
+
+  std::vector<const char *> cut(P + 1);
+  cut[0] = body;
+  cut[P] = fileEnd;
+  for (size_t t = 1; t < P; ++t) {
+    const char *e = lineEnd(body + bodyLen * t / P - 1);
+    cut[t] = std::max(cut[t - 1], e == fileEnd ? fileEnd : e + 1);
   }
 
-  table0.clear();
-  table0.reserve(n0);
-  table1.clear();
-  table1.reserve(n1);
-
-  auto read_n = [&](size_t count, auto &tbl) -> bool {
-    size_t read = 0;
-    std::string line;
-    while (read < count && std::getline(in, line)) {
-      if (is_blank_line(line))
-        continue;
-
-      std::istringstream iss(line);
-      Record rec;
-
-      // parse the key
-      std::uint32_t temp_key;
-      if (!(iss >> temp_key)) {
-        std::cerr << "Error parsing key in line: \"" << line << "\"\n";
-        return false;
+  // --- 3) count data lines per chunk ---
+  std::vector<size_t> first(P + 1, 0);
+  {
+    parallelFor(P, [&](size_t t) {
+      size_t lines = 0;
+      const char *done = cut[t];
+      for (const char *p = cut[t]; p < cut[t + 1];) {
+        const char *e = lineEnd(p);
+        lines += !is_blank_line(p, e);
+        p = e + 1;
+        if (p - done >= releaseBytes) {
+          release_mapped_pages(done, p);
+          done = p;
+        }
       }
-      rec.key = temp_key;
-
-      // the rest of the line—including spaces—is the payload
-      std::string rest;
-      std::getline(iss, rest);
-      // strip a single leading space if present
-      if (!rest.empty() && rest.front() == ' ')
-        rest.erase(0, 1);
-
-      // Copy payload into char array, ensuring null termination
-      std::memset(rec.pay, 0, DATA_LENGTH);
-      size_t copy_len =
-          std::min(rest.length(), static_cast<size_t>(DATA_LENGTH - 1));
-      std::strncpy(rec.pay, rest.c_str(), copy_len);
-      rec.pay[copy_len] = '\0';
-
-      // Initialize other fields
-      rec.idx = read;
-      rec.cntSelf = 0;
-      rec.cntExpand = 0;
-
-      tbl.push_back(rec);
-      ++read;
-    }
-    if (read < count) {
-      std::cerr << "Error: only read " << read << " of " << count
-                << " requested records\n";
-      return false;
-    }
-    return true;
-  };
+      release_mapped_pages(done, cut[t + 1]);
+      first[t + 1] = lines;
+    });
+  }
+  for (size_t t = 0; t < P; ++t)
+    first[t + 1] += first[t];
 
-  if (!read_n(n0, table0))
+  if (first[P] < total) {
+    std::cerr << "Error: only read " << first[P] << " of " << total
+              << " requested records\n";
+    unmap();
     return false;
-  if (!read_n(n1, table1))
+  }
+
+  table0.num_tuples = n0;
+  table1.num_tuples = n1;
+  if (n0)
+    table0.tuples =
+        static_cast<row_t *>(std::aligned_alloc(32, n0 * sizeof(row_t)));
+  if (n1)
+    table1.tuples =
+        static_cast<row_t *>(std::aligned_alloc(32, n1 * sizeof(row_t)));
+  if ((n0 && !table0.tuples) || (n1 && !table1.tuples)) {
+    std::cerr << "Error: cannot allocate " << total << " records\n";
+    std::free(table0.tuples);
+    std::free(table1.tuples);
+    table0 = table1 = table_t{};
+    unmap();
     return false;
+  }
+
+  populate_two_tables(table0, table1, numThreads);
+
+  // --- 4) parse records straight into their final slots ---
+  std::vector<const char *> badLine(P, nullptr);
+  {
+    parallelFor(P, [&](size_t t) {
+      size_t r = first[t];
+      const char *done = cut[t];
+      for (const char *p = cut[t]; p < cut[t + 1] && r < total;) {
+        if (p - done >= releaseBytes) {
+          release_mapped_pages(done, p);
+          done = p;
+        }
+        const char *e = lineEnd(p);
+        if (!is_blank_line(p, e)) {
+          bool ok = (r < n0)
+                        ? parse_record(p, e, r, table0.tuples[r])
+                        : parse_record(p, e, r - n0, table1.tuples[r - n0]);
+          if (!ok) {
+            badLine[t] = p;
+            return;
+          }
+          ++r;
+        }
+        p = e + 1;
+      }
+    });
+  }
+
+  for (const char *p : badLine) {
+    if (p) {
+      std::cerr << "Error parsing key in line: \"" << std::string(p, lineEnd(p))
+                << "\"\n";
+      std::free(table0.tuples);
+      std::free(table1.tuples);
+      table0 = table1 = table_t{};
+      unmap();
+      return false;
+    }
+  }
 
+  unmap();
   return true;
 }
 
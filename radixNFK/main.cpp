@@ -3,29 +3,42 @@
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <sys/mman.h>
+#include <sys/resource.h>
 
 #include "align_table.h"
 #include "backfill_dummies.h"
+#include "binary_tables.h"
 #include "carry_forward.h"
 #include "inputs.h"
 #include "merge.h"
+#include "output_sink.h"
 #include "parallel_counts.h"
+#include "parallel_for.h"
 #include "prefix_sum_expand.h"
 #include "replace_dummies.h"
 #include "result_indices.h"
+#include "result_writer.h"
 #include "slice_utils.h"
 
 extern "C" {
 #include "bitonic.h"
+#include "join_arena.h"
+#include "numa_shuffle.h"
 #include "radix_join_counts.h"
 #include "radix_join_idx.h"
+#include "radix_scatter.h"
+#include "radix_tuner.h"
+#include "scratch.h"
 #include "threading.h"
 }
 
 // #define PRE_SORTED // use this if your tables are already sorted
+// (binary inputs carry this as BINARY_TABLE_SORTED, see binary_tables.h)
 
 /*
  * Define this macro if your process is being killed due to insufficient memory.
@@ -38,9 +51,114 @@ extern "C" {
 // Global timer
 std::chrono::high_resolution_clock::time_point tStart;
 
+// --numa=<strategy>: NUMA shuffling strategy of the pass-1 scatter
+inline bool parseNumaStrategy(const std::string &arg) {
+  const std::string prefix = "--numa=";
+  if (arg.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  const std::string v = arg.substr(prefix.size());
+  if (v == "ring")
+    numa_set_shuffle_strategy(RING);
+  else if (v == "next")
+    numa_set_shuffle_strategy(NEXT);
+  else if (v == "random")
+    numa_set_shuffle_strategy(RANDOM);
+  else
+    return false;
+  return true;
+}
+
+// --scatter=<kind>: stores of the radix partitioning scatter
+inline bool parseScatter(const std::string &arg) {
+  const std::string prefix = "--scatter=";
+  if (arg.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  const std::string v = arg.substr(prefix.size());
+  if (v == "direct")
+    radix_set_scatter(SCATTER_DIRECT);
+  else if (v == "swwc")
+    radix_set_scatter(SCATTER_SWWC);
+  else
+    return false;
+  return true;
+}
+
+// --pages=<kind>: pages of the radix partition buffers
+inline bool parsePages(const std::string &arg) {
+  const std::string prefix = "--pages=";
+  if (arg.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  const std::string v = arg.substr(prefix.size());
+  if (v == "default")
+    join_arena_set_huge_pages(false);
+  else if (v == "huge")
+    join_arena_set_huge_pages(true);
+  else
+    return false;
+  return true;
+}
+
+// --sort=<engine>: oblivious sort used for the input tables (and alignment)
+inline bool parseSortEngine(const std::string &arg) {
+  const std::string prefix = "--sort=";
+  if (arg.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  const std::string v = arg.substr(prefix.size());
+  if (v == "bitonic")
+    set_sort_engine(SORT_BITONIC);
+  else if (v == "bucket")
+    set_sort_engine(SORT_BUCKET);
+  else if (v == "shuffle")
+    set_sort_engine(SORT_SHUFFLE);
+  else if (v == "tag")
+    set_sort_engine(SORT_TAG);
+  else
+    return false;
+  return true;
+}
+
+// --radix-bits=<n|auto> and --passes=<n>: radix fan-out of the joins, by
+// default the one of the build (NUM_RADIX_BITS and NUM_PASSES)
+struct RadixConfig {
+  radix_params params = radix_default_params();
+  bool autoTune = false;
+  cache_geometry geo{};
+};
+
+inline bool parseRadix(const std::string &arg, RadixConfig &cfg) {
+  const std::string bitsPrefix = "--radix-bits=", passesPrefix = "--passes=";
+  int *field;
+  std::string v;
+  if (arg.compare(0, bitsPrefix.size(), bitsPrefix) == 0) {
+    v = arg.substr(bitsPrefix.size());
+    field = &cfg.params.bits;
+    if (v == "auto") {
+      cfg.autoTune = true;
+      return true;
+    }
+  } else if (arg.compare(0, passesPrefix.size(), passesPrefix) == 0) {
+    v = arg.substr(passesPrefix.size());
+    field = &cfg.params.passes;
+  } else {
+    return false;
+  }
+  char *end;
+  long n = std::strtol(v.c_str(), &end, 10);
+  if (v.empty() || *end != '\0' || n < 1 || n > 32)
+    return false;
+  *field = static_cast<int>(n);
+  return true;
+}
+
+// radix parameters for a join of nR with nS rows
+inline radix_params radixFor(const RadixConfig &cfg, std::uint64_t nR,
+                             std::uint64_t nS, std::uint32_t threads) {
+  return cfg.autoTune ? radix_autotune(nR, nS, threads, &cfg.geo) : cfg.params;
+}
+
 int main(int argc, char *argv[]) {
-  printf("Set number of radix bits and passes for your workload in "
-         "external/radix_partition/CMakeLists.txt.\n");
+  printf("Set the radix bits and passes for your workload with --radix-bits "
+         "and --passes, or --radix-bits=auto.\n");
   std::uint32_t numThreads = 32;
   std::string inputPath = "../amazon.txt";
 
@@ -48,97 +166,134 @@ int main(int argc, char *argv[]) {
     numThreads = std::max<std::uint32_t>(1, std::stoul(argv[1]));
   if (argc > 2)
     inputPath = argv[2];
-  if (argc > 3) {
-    std::cerr << "Program takes 2 arguments: number of threads and input "
-                 "filepath."
-              << std::endl;
+  SinkConfig sink;
+  RadixConfig radix;
+  for (int a = 3; a < argc; ++a) {
+    if (!parseSink(argv[a], sink) && !parseNumaStrategy(argv[a]) &&
+        !parseSortEngine(argv[a]) && !parseRadix(argv[a], radix) &&
+        !parseScatter(argv[a]) && !parsePages(argv[a])) {
+      std::cerr << "Program takes 2 arguments: number of threads and input "
+                   "filepath, optionally followed by "
+                   "--sink=text|binary|count|checksum|sum:R|sum:S, "
+                   "--numa=ring|next|random, --sort=bitonic|bucket|shuffle|tag,"
+                   " --radix-bits=<n>|auto, --passes=<n>, "
+                   "--scatter=direct|swwc and --pages=default|huge."
+                << std::endl;
+      return 1;
+    }
+  }
+  if (radix.autoTune) {
+    cache_geometry_detect(&radix.geo);
+  } else if (!radix_params_valid(&radix.params)) {
+    std::cerr << "Unsupported radix configuration: " << radix.params.bits
+              << " bits in " << radix.params.passes << " pass(es); at most "
+              << RADIX_MAX_PASSES << " passes of at most "
+              << RADIX_MAX_PASS_BITS << " bits each and " << RADIX_MAX_BITS
+              << " bits in total." << std::endl;
     return 1;
   }
   printf("Input   : %s\n", inputPath.c_str());
   printf("Threads : %u\n", numThreads);
 
-  std::vector<Record> t0, t1;
-  if (!load_two_tables(inputPath, t0, t1))
-    return 1;
+  worker_pool_init(numThreads);
+  std::atexit(worker_pool_shutdown);
+  printf("NUMA    : %d node(s)\n", worker_pool_num_nodes());
+  printf("Sort    : %s\n", sort_engine_name(get_sort_engine()));
+
+  bool preSorted = false;
+#ifdef PRE_SORTED
+  preSorted = true;
+#endif
 
-  if (t0.size() > t1.size())
-    std::swap(t0, t1);
+  table_t R, S;
+  if (is_binary_tables(inputPath)) {
+    std::uint32_t flags;
+    if (!map_two_tables(inputPath, R, S, flags, numThreads))
+      return 1;
+    preSorted |= (flags & BINARY_TABLE_SORTED) != 0;
+  } else if (!load_two_tables(inputPath, R, S, numThreads)) {
+    return 1;
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("Peak RSS after load: %.1f MiB\n", usage.ru_maxrss / 1024.0);
 
-  std::vector<Record> partR;
-  partR.reserve(t0.size());
-  std::vector<Record> partS;
-  partS.reserve(t1.size());
+  if (R.num_tuples > S.num_tuples)
+    std::swap(R, S);
 
   std::uint32_t thrR = std::max<std::uint32_t>(
-      1, ceil((static_cast<double>(t0.size()) / (t0.size() + t1.size())) *
+      1, ceil((static_cast<double>(R.num_tuples) /
+               (R.num_tuples + S.num_tuples)) *
               numThreads));
   std::uint32_t thrS = std::max<std::uint32_t>(1, numThreads - thrR);
   printf("thrR: %u, thrS: %u\n", thrR, thrS);
 
-  table_t R, S;
-  R.tuples = new row_t[t0.size()];
-  std::memcpy(R.tuples, t0.data(), t0.size() * sizeof(Record));
-  R.num_tuples = static_cast<uint32_t>(t0.size());
-
-  S.tuples = new row_t[t1.size()];
-  std::memcpy(S.tuples, t1.data(), t1.size() * sizeof(Record));
-  S.num_tuples = static_cast<uint32_t>(t1.size());
-
-  t0.clear();
-  t0.shrink_to_fit();
-  t1.clear();
-  t1.shrink_to_fit();
-
   auto slices_R = buildSlices(R.num_tuples, thrR);
   auto slices_S = buildSlices(S.num_tuples, thrS);
 
   std::uint32_t m;
-#ifndef PRE_SORTED
-  extern size_t total_num_threads;
-  total_num_threads = numThreads;
-  thread_system_init();
-
-  std::vector<std::thread> pool;
-  for (size_t i = 1; i < numThreads; ++i)
-    pool.emplace_back(thread_start_work);
-
-  tStart = std::chrono::high_resolution_clock::now();
-  bitonic_sort_(R.tuples, true, 0, R.num_tuples, numThreads, false);
-  bitonic_sort_(S.tuples, true, 0, S.num_tuples, numThreads, false);
-
-  thread_release_all();
-  for (auto &t : pool)
-    t.join();
-  thread_system_cleanup();
-#else
-  tStart = std::chrono::high_resolution_clock::now();
-#endif
+  if (!preSorted) {
+    tStart = std::chrono::high_resolution_clock::now();
+    // R and S are sorted concurrently, R by thrR threads and S by thrS
+    struct bitonic_sorter sorters[2];
+    bitonic_sorter_init(&sorters[0], R.tuples, thrR, false);
+    bitonic_sorter_init(&sorters[1], S.tuples, thrS, false);
+    struct SortTables {
+      bitonic_sorter *sorters;
+      int nR, nS;
+    } sortTables{sorters, static_cast<int>(R.num_tuples),
+                 static_cast<int>(S.num_tuples)};
+    thread_run_on_pool(
+        [](void *arg, size_t) {
+          auto *T = static_cast<SortTables *>(arg);
+          bitonic_job jobR;
+          bitonic_sorter_start(&jobR, &T->sorters[0], true, 0, T->nR);
+          bitonic_sorter_sort(&T->sorters[1], true, 0, T->nS);
+          bitonic_sorter_wait(&jobR);
+        },
+        &sortTables, numThreads);
+  } else {
+    tStart = std::chrono::high_resolution_clock::now();
+  }
 
-  std::thread partitionR([&] {
-    std::vector<int> lastLen(slices_R.size()), mergeVal(slices_R.size() - 1);
-    parallelCounts(R, slices_R, lastLen, mergeVal);
-    replaceWithDummiesParallel(R, slices_R);
-  });
-  std::thread partitionS([&] {
-    std::vector<int> lastLen(slices_S.size()), mergeVal(slices_S.size() - 1);
-    parallelCounts(S, slices_S, lastLen, mergeVal);
-    replaceWithDummiesParallel(S, slices_S);
-  });
-  partitionR.join();
-  partitionS.join();
-
-  RHO(&R, &S, numThreads);
-
-  std::thread processR([&] {
-    backfillDummiesParallel(R, slices_R);
-    m = prefixSumExpandParallel(R, slices_R);
-  });
-  std::thread processS([&] {
-    backfillDummiesParallel(S, slices_S);
-    m = prefixSumExpandParallel(S, slices_S);
-  });
-  processR.join();
-  processS.join();
+  parallelInvoke(
+      thrR,
+      [&] {
+        std::vector<int> lastLen(slices_R.size()),
+            mergeVal(slices_R.size() - 1);
+        parallelCounts(R, slices_R, lastLen, mergeVal);
+        replaceWithDummiesParallel(R, slices_R);
+      },
+      [&] {
+        std::vector<int> lastLen(slices_S.size()),
+            mergeVal(slices_S.size() - 1);
+        parallelCounts(S, slices_S, lastLen, mergeVal);
+        replaceWithDummiesParallel(S, slices_S);
+      });
+
+  const radix_params radixCounts =
+      radixFor(radix, R.num_tuples, S.num_tuples, numThreads);
+  printf("Radix bits: %d, Passes: %d%s\n", radixCounts.bits,
+         radixCounts.passes, radix.autoTune ? " (auto)" : "");
+  RHO(&R, &S, numThreads, &radixCounts);
+
+  parallelInvoke(
+      thrR,
+      [&] {
+        backfillDummiesParallel(R, slices_R);
+        m = prefixSumExpandParallel(R, slices_R);
+      },
+      [&] {
+        backfillDummiesParallel(S, slices_S);
+        m = prefixSumExpandParallel(S, slices_S);
+      });
+
+  if (sink.kind == SinkKind::Count || sink.kind == SinkKind::Sum) {
+    join_result_t res = sink.sumS ? aggregateFromCounts(S, slices_S)
+                                  : aggregateFromCounts(R, slices_R);
+    reportAggregate(sink, res);
+    return 0;
+  }
 
   std::vector<Slice> slices_m = buildSlices(m, numThreads);
 
@@ -153,8 +308,8 @@ int main(int argc, char *argv[]) {
   expandedS.num_tuples = m;
   expandedR.tuples = static_cast<row_t *>(std::aligned_alloc(32, bytes));
   expandedS.tuples = static_cast<row_t *>(std::aligned_alloc(32, bytes));
-  std::memset(expandedR.tuples, 0, bytes);
-  std::memset(expandedS.tuples, 0, bytes);
+  clear_table_parallel(expandedR, slices_m);
+  clear_table_parallel(expandedS, slices_m);
 
 #ifndef INSUFFICIENT_MEMORY
   std::vector<Slice> slices_mR =
@@ -163,52 +318,66 @@ int main(int argc, char *argv[]) {
       m, std::max<std::uint32_t>(
              1, numThreads - (std::max<std::uint32_t>(1, numThreads / 2))));
 
-  std::thread radixR([&] {
-    if (m >= R.num_tuples) {
-      RHO_idx(&R, &idxTable, thrR, &expandedR, true);
-    } else {
-      RHO_idx(&idxTable, &R, thrR, &expandedR, false);
-    }
-    carryForwardParallel(expandedR, slices_mR);
-  });
-  std::thread radixS([&] {
-    if (m >= S.num_tuples) {
-      RHO_idx(&S, &idxTable, thrS, &expandedS, true);
-    } else {
-      RHO_idx(&idxTable, &S, thrS, &expandedS, false);
-    }
-    carryForwardParallel(expandedS, slices_mS);
-  });
-  radixR.join();
-  radixS.join();
+  parallelInvoke(
+      thrR,
+      [&] {
+        const radix_params params =
+            radixFor(radix, m, R.num_tuples, thrR);
+        if (m >= R.num_tuples) {
+          RHO_idx(&R, &idxTable, thrR, &expandedR, true, &params);
+        } else {
+          RHO_idx(&idxTable, &R, thrR, &expandedR, false, &params);
+        }
+        carryForwardParallel(expandedR, slices_mR);
+      },
+      [&] {
+        const radix_params params =
+            radixFor(radix, m, S.num_tuples, thrS);
+        if (m >= S.num_tuples) {
+          RHO_idx(&S, &idxTable, thrS, &expandedS, true, &params);
+        } else {
+          RHO_idx(&idxTable, &S, thrS, &expandedS, false, &params);
+        }
+        carryForwardParallel(expandedS, slices_mS);
+      });
 #else
+  const radix_params radixR =
+      radixFor(radix, m, R.num_tuples, numThreads);
   if (m >= R.num_tuples) {
-    RHO_idx(&R, &idxTable, numThreads, &expandedR, true);
+    RHO_idx(&R, &idxTable, numThreads, &expandedR, true, &radixR);
   } else {
-    RHO_idx(&idxTable, &R, numThreads, &expandedR, false);
+    RHO_idx(&idxTable, &R, numThreads, &expandedR, false, &radixR);
   }
   carryForwardParallel(expandedR, slices_m);
 
+  const radix_params radixS =
+      radixFor(radix, m, S.num_tuples, numThreads);
   if (m >= S.num_tuples) {
-    RHO_idx(&S, &idxTable, numThreads, &expandedS, true);
+    RHO_idx(&S, &idxTable, numThreads, &expandedS, true, &radixS);
   } else {
-    RHO_idx(&idxTable, &S, numThreads, &expandedS, false);
+    RHO_idx(&idxTable, &S, numThreads, &expandedS, false, &radixS);
   }
   carryForwardParallel(expandedS, slices_m);
 #endif
+  scratch_release();
+  join_arena_release();
 
   alignTableParallel(expandedS, slices_m, numThreads);
 
+  if (sink.kind == SinkKind::Checksum) {
+    reportAggregate(sink,
+                    aggregateAligned(expandedR, expandedS, slices_m, sink));
+    return 0;
+  }
+
   std::vector<JoinRec> joinResults;
   mergeExpandedParallel(expandedR, expandedS, numThreads, joinResults);
-  {
-    std::ofstream outER("join.txt");
-    for (const auto &j : joinResults)
-      outER << j.keyR << ' ' << j.payR << ' ' << j.keyS << ' ' << j.payS
-            << '\n';
-  }
+  const char *outPath = writeJoinResults(sink, joinResults, slices_m);
+  if (!outPath)
+    return 1;
 
-  printf("Join result rows : %ld (written to join.txt)\n", expandedR.num_tuples);
+  printf("Join result rows : %ld (written to %s)\n", expandedR.num_tuples,
+         outPath);
 
   return 0;
 }
@@ -1,8 +1,8 @@
 #pragma once
 #include "inputs.h"
+#include "parallel_for.h"
 #include "slice_utils.h"
 #include <cstring>
-#include <thread>
 #include <vector>
 
 struct JoinRec {
@@ -24,18 +24,13 @@ inline void mergeExpandedParallel(const table_t &expandedR,
   out.resize(N);
 
   auto slices = buildSlices(N, numThreads);
-  std::vector<std::thread> pool;
-  pool.reserve(slices.size());
-
-  for (const Slice &sl : slices)
-    pool.emplace_back([&, sl] {
-      for (std::size_t i = sl.begin; i < sl.end; ++i) {
-        out[i].keyR = expandedR.tuples[i].key;
-        out[i].keyS = expandedS.tuples[i].key;
-        std::memcpy(&out[i].payR, &expandedR.tuples[i].pay, DATA_LENGTH);
-        std::memcpy(&out[i].payS, &expandedS.tuples[i].pay, DATA_LENGTH);
-      }
-    });
-  for (auto &th : pool)
-    th.join();
+  parallelFor(slices.size(), [&](std::size_t t) {
+    const Slice sl = slices[t];
+    for (std::size_t i = sl.begin; i < sl.end; ++i) {
+      out[i].keyR = expandedR.tuples[i].key;
+      out[i].keyS = expandedS.tuples[i].key;
+      std::memcpy(&out[i].payR, &expandedR.tuples[i].pay, DATA_LENGTH);
+      std::memcpy(&out[i].payS, &expandedS.tuples[i].pay, DATA_LENGTH);
+    }
+  });
 }
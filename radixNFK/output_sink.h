@@ -0,0 +1,236 @@
+#pragma once
+#include "data-types.h"
+#include "inputs.h"
+#include "merge.h"
+#include "parallel_for.h"
+#include "result_writer.h"
+#include "slice_utils.h"
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+ * Output sinks for the join result, selected with --sink=<kind>:
+ *
+ *   text      join.txt, "<keyR> <payR> <keyS> <payS>" per row (default)
+ *   binary    join.bin, a JoinResultHeader followed by one ResultRow per row
+ *   count     COUNT(*)
+ *   checksum  order-independent checksum: sum of resultRowHash over all rows
+ *   sum:R     SUM of the leading decimal value of payR (column 2 of join.txt)
+ *   sum:S     SUM of the leading decimal value of payS (column 4 of join.txt)
+ *
+ * The aggregates fill join_result_t and write no rows at all. Each row of the
+ * input is visited exactly once and contributes through masks, so the access
+ * pattern only depends on the table sizes. Sums wrap modulo 2^64.
+ */
+enum class SinkKind { Text, Binary, Count, Checksum, Sum };
+
+struct SinkConfig {
+  SinkKind kind = SinkKind::Text;
+  bool sumS = true; // sum:S or sum:R
+};
+
+inline bool isAggregateSink(const SinkConfig &cfg) {
+  return cfg.kind == SinkKind::Count || cfg.kind == SinkKind::Checksum ||
+         cfg.kind == SinkKind::Sum;
+}
+
+inline bool parseSink(const std::string &arg, SinkConfig &cfg) {
+  const std::string prefix = "--sink=";
+  if (arg.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  const std::string v = arg.substr(prefix.size());
+  if (v == "text")
+    cfg.kind = SinkKind::Text;
+  else if (v == "binary")
+    cfg.kind = SinkKind::Binary;
+  else if (v == "count")
+    cfg.kind = SinkKind::Count;
+  else if (v == "checksum")
+    cfg.kind = SinkKind::Checksum;
+  else if (v == "sum:R" || v == "sum:S") {
+    cfg.kind = SinkKind::Sum;
+    cfg.sumS = v.back() == 'S';
+  } else
+    return false;
+  return true;
+}
+
+#define JOIN_RESULT_MAGIC "OBLRDXJR"
+#define JOIN_RESULT_VERSION 1
+
+struct JoinResultHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t headerSize;
+  std::uint32_t rowSize;
+  std::uint32_t dataLength;
+  std::uint64_t rows;
+};
+
+// one result row of join.bin; payloads are NUL-padded
+struct ResultRow {
+  std::uint32_t keyR;
+  std::uint32_t keyS;
+  char payR[DATA_LENGTH];
+  char payS[DATA_LENGTH];
+};
+
+inline JoinResultHeader joinResultHeader(std::uint64_t rows) {
+  JoinResultHeader hdr{};
+  std::memcpy(hdr.magic, JOIN_RESULT_MAGIC, sizeof(hdr.magic));
+  hdr.version = JOIN_RESULT_VERSION;
+  hdr.headerSize = sizeof(hdr);
+  hdr.rowSize = sizeof(ResultRow);
+  hdr.dataLength = DATA_LENGTH;
+  hdr.rows = rows;
+  return hdr;
+}
+
+// Payload bytes up to the first NUL, zero-padded to whole 64-bit words. All
+// DATA_LENGTH bytes are read whatever the payload length.
+constexpr int payloadWordCount = (DATA_LENGTH + 7) / 8;
+
+inline void payloadWords(const char *pay, std::uint64_t w[payloadWordCount]) {
+  unsigned char b[payloadWordCount * 8] = {};
+  unsigned char alive = 0xff;
+  for (int j = 0; j < DATA_LENGTH; ++j) {
+    alive &= -static_cast<unsigned char>(pay[j] != 0);
+    b[j] = static_cast<unsigned char>(pay[j]) & alive;
+  }
+  std::memcpy(w, b, sizeof(b));
+}
+
+// Leading decimal digits of a payload as a number, 0 if there are none.
+inline std::uint64_t payloadValue(const char *pay) {
+  std::uint64_t v = 0, alive = ~std::uint64_t(0);
+  for (int j = 0; j < DATA_LENGTH; ++j) {
+    std::uint64_t d = static_cast<unsigned char>(pay[j]) - std::uint64_t('0');
+    alive &= -static_cast<std::uint64_t>(d < 10);
+    v = (alive & (v * 10 + d)) | (~alive & v);
+  }
+  return v;
+}
+
+// splitmix64 finalizer
+inline std::uint64_t mix64(std::uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+inline std::uint64_t resultRowHash(std::uint32_t keyR, const char *payR,
+                                   std::uint32_t keyS, const char *payS) {
+  std::uint64_t w[payloadWordCount];
+  std::uint64_t h = mix64(keyR | static_cast<std::uint64_t>(keyS) << 32);
+  payloadWords(payR, w);
+  for (int j = 0; j < payloadWordCount; ++j)
+    h = mix64(h ^ w[j]);
+  payloadWords(payS, w);
+  for (int j = 0; j < payloadWordCount; ++j)
+    h = mix64(h ^ w[j]);
+  return h;
+}
+
+// Runs rowFn(i, acc) over every row of every slice, one thread per slice, and
+// adds up the per-slice matches/checksum/sum.
+template <typename RowFn>
+inline join_result_t aggregateParallel(const std::vector<Slice> &slices,
+                                       const RowFn &rowFn) {
+  std::vector<join_result_t> part(slices.size(), join_result_t{});
+  parallelFor(slices.size(), [&](std::size_t t) {
+    join_result_t acc{};
+    for (std::size_t i = slices[t].begin; i < slices[t].end; ++i)
+      rowFn(i, acc);
+    part[t] = acc;
+  });
+
+  join_result_t res{};
+  for (const join_result_t &p : part) {
+    res.matches += p.matches;
+    res.checksum += p.checksum;
+    res.sum += p.sum;
+  }
+  return res;
+}
+
+// COUNT and SUM from R or S after backfillDummiesParallel, where cntExpand of
+// every row is the number of result rows it appears in. The result rows are
+// never built.
+inline join_result_t aggregateFromCounts(const table_t &T,
+                                         const std::vector<Slice> &slices) {
+  return aggregateParallel(slices, [&](std::size_t i, join_result_t &acc) {
+    const row_t &r = T.tuples[i];
+    acc.matches += r.cntExpand;
+    acc.sum += r.cntExpand * payloadValue(r.pay);
+  });
+}
+
+// All aggregates over the aligned expanded tables, row i of expandedR joined
+// with row i of expandedS, in place of merging and writing them.
+inline join_result_t aggregateAligned(const table_t &expandedR,
+                                      const table_t &expandedS,
+                                      const std::vector<Slice> &slices,
+                                      const SinkConfig &cfg) {
+  const row_t *pays = cfg.sumS ? expandedS.tuples : expandedR.tuples;
+  return aggregateParallel(slices, [&](std::size_t i, join_result_t &acc) {
+    const row_t &r = expandedR.tuples[i];
+    const row_t &s = expandedS.tuples[i];
+    acc.matches += 1;
+    acc.checksum += resultRowHash(r.key, r.pay, s.key, s.pay);
+    acc.sum += payloadValue(pays[i].pay);
+  });
+}
+
+inline void reportAggregate(const SinkConfig &cfg, const join_result_t &res) {
+  printf("Join result rows: %" PRIu64 "\n", res.matches);
+  if (cfg.kind == SinkKind::Checksum)
+    printf("Join result checksum: 0x%016" PRIx64 "\n", res.checksum);
+  else if (cfg.kind == SinkKind::Sum)
+    printf("Join result SUM(%s): %" PRIu64 "\n", cfg.sumS ? "payS" : "payR",
+           res.sum);
+}
+
+// join.bin rows from the merged result
+struct JoinRecBinaryFormat {
+  const JoinRec *rows;
+
+  static constexpr std::size_t maxRowBytes = sizeof(ResultRow);
+
+  std::size_t length(std::size_t) const { return sizeof(ResultRow); }
+
+  char *format(std::size_t i, char *p) const {
+    const JoinRec &j = rows[i];
+    ResultRow out;
+    out.keyR = j.keyR;
+    out.keyS = j.keyS;
+    std::memcpy(out.payR, j.payR, DATA_LENGTH);
+    std::memcpy(out.payS, j.payS, DATA_LENGTH);
+    std::memcpy(p, &out, sizeof(out));
+    return p + sizeof(out);
+  }
+};
+
+// Writes the merged result to join.txt or join.bin; returns the path written,
+// or nullptr on error.
+inline const char *writeJoinResults(const SinkConfig &cfg,
+                                    const std::vector<JoinRec> &rows,
+                                    const std::vector<Slice> &slices) {
+  if (cfg.kind == SinkKind::Binary) {
+    const JoinResultHeader hdr = joinResultHeader(rows.size());
+    return writeResultParallel("join.bin", slices,
+                               JoinRecBinaryFormat{rows.data()}, &hdr,
+                               sizeof(hdr))
+               ? "join.bin"
+               : nullptr;
+  }
+  return writeResultParallel("join.txt", slices, JoinRecFormat{rows.data()})
+             ? "join.txt"
+             : nullptr;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include "worker_pool.h"
+}
+
+// Runs f(i) for every i in [begin, end) on the calling thread's worker pool
+// team and returns when all calls are done (see worker_pool.h).
+template <typename F>
+inline void parallelFor(std::size_t begin, std::size_t end, F &&f) {
+  if (end <= begin)
+    return;
+  struct Call {
+    std::remove_reference_t<F> *f;
+    std::size_t begin;
+  } call{&f, begin};
+  worker_pool_run(
+      static_cast<int>(end - begin),
+      [](void *arg, int i) {
+        Call *c = static_cast<Call *>(arg);
+        (*c->f)(c->begin + static_cast<std::size_t>(i));
+      },
+      &call);
+}
+
+template <typename F> inline void parallelFor(std::size_t count, F &&f) {
+  parallelFor(0, count, std::forward<F>(f));
+}
+
+// Runs a() on the first widthA workers of the calling thread's team and,
+// concurrently, b() on the others.
+template <typename A, typename B>
+inline void parallelInvoke(unsigned widthA, A &&a, B &&b) {
+  worker_pool_invoke2(
+      static_cast<int>(widthA),
+      [](void *arg) { (*static_cast<std::remove_reference_t<A> *>(arg))(); },
+      &a,
+      [](void *arg) { (*static_cast<std::remove_reference_t<B> *>(arg))(); },
+      &b);
+}
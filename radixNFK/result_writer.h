@@ -0,0 +1,187 @@
+#pragma once
+#include "inputs.h"
+#include "merge.h"
+#include "parallel_for.h"
+#include "slice_utils.h"
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Parallel text writer for the join result.
+ *
+ * Every slice is written by one thread: it sums the formatted length of its
+ * rows, takes its file offset from the end of the previous slice, then formats
+ * its rows with std::to_chars into a private buffer and pwrite()s the buffer
+ * at that offset whenever it fills up. Only the offsets are chained, so a
+ * slice waits for the lengths of the slices before it, not for their output.
+ * An optional fixed-size header in front of the rows is written separately.
+ *
+ * A row format provides
+ *   static constexpr std::size_t maxRowBytes;
+ *   std::size_t length(std::size_t i) const;  // formatted bytes of row i
+ *   char *format(std::size_t i, char *p) const;  // writes row i, returns end
+ */
+
+inline std::size_t decimalLength(std::uint32_t v) {
+  std::size_t n = 1;
+  while (v >= 10) {
+    v /= 10;
+    ++n;
+  }
+  return n;
+}
+
+inline char *formatDecimal(char *p, std::uint32_t v) {
+  return std::to_chars(p, p + 10, v).ptr;
+}
+
+// payloads are NUL-terminated within DATA_LENGTH, as streamed by operator<<
+inline std::size_t payloadLength(const char *pay) {
+  return strnlen(pay, DATA_LENGTH);
+}
+
+inline char *formatPayload(char *p, const char *pay) {
+  const std::size_t len = payloadLength(pay);
+  std::memcpy(p, pay, len);
+  return p + len;
+}
+
+class ResultWriter {
+public:
+  static constexpr std::size_t bufferBytes = 1 << 20;
+
+  ResultWriter(const std::string &path, std::size_t numSlices,
+               std::uint64_t headerBytes = 0)
+      : path_(path), ends_(new std::atomic<std::uint64_t>[numSlices + 1]) {
+    for (std::size_t t = 0; t <= numSlices; ++t)
+      ends_[t].store(notReady, std::memory_order_relaxed);
+    ends_[0].store(headerBytes, std::memory_order_relaxed);
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0)
+      std::cerr << "Error: cannot create \"" << path << "\"\n";
+  }
+
+  ~ResultWriter() {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  bool ok() const { return fd_ >= 0; }
+
+  // Writes the headerBytes reserved in front of the first slice.
+  void writeHeader(const void *header, std::size_t bytes) {
+    std::uint64_t off = 0;
+    const char *h = static_cast<const char *>(header);
+    flush(h, h + bytes, off);
+  }
+
+  // Writes rows [sl.begin, sl.end) as slice t. Must be called exactly once
+  // for every t < numSlices, each from its own thread.
+  template <typename Format>
+  void writeSlice(std::size_t t, const Slice &sl, const Format &fmt) {
+    std::uint64_t bytes = 0;
+    for (std::size_t i = sl.begin; i < sl.end; ++i)
+      bytes += fmt.length(i);
+
+    std::uint64_t off;
+    while ((off = ends_[t].load(std::memory_order_acquire)) == notReady)
+      std::this_thread::yield();
+    ends_[t + 1].store(off + bytes, std::memory_order_release);
+
+    std::unique_ptr<char[]> buf(new char[bufferBytes]);
+    char *p = buf.get();
+    char *const flushAt = buf.get() + bufferBytes - Format::maxRowBytes;
+    for (std::size_t i = sl.begin; i < sl.end; ++i) {
+      p = fmt.format(i, p);
+      if (p > flushAt) {
+        flush(buf.get(), p, off);
+        p = buf.get();
+      }
+    }
+    flush(buf.get(), p, off);
+  }
+
+  // Closes the file; false if any write failed.
+  bool finish() {
+    bool good = ok() && !failed_.load();
+    if (fd_ >= 0 && close(fd_) != 0)
+      good = false;
+    fd_ = -1;
+    if (!good)
+      std::cerr << "Error: failed writing \"" << path_ << "\"\n";
+    return good;
+  }
+
+private:
+  static constexpr std::uint64_t notReady = ~std::uint64_t(0);
+
+  void flush(const char *b, const char *e, std::uint64_t &off) {
+    while (b < e && fd_ >= 0) {
+      ssize_t w = pwrite(fd_, b, e - b, static_cast<off_t>(off));
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w <= 0) {
+        failed_.store(true);
+        return;
+      }
+      b += w;
+      off += w;
+    }
+  }
+
+  std::string path_;
+  std::unique_ptr<std::atomic<std::uint64_t>[]> ends_;
+  std::atomic<bool> failed_{false};
+  int fd_ = -1;
+};
+
+// Writes the rows of all slices to path, one thread per slice, after an
+// optional header.
+template <typename Format>
+inline bool writeResultParallel(const std::string &path,
+                                const std::vector<Slice> &slices,
+                                const Format &fmt,
+                                const void *header = nullptr,
+                                std::size_t headerBytes = 0) {
+  ResultWriter writer(path, slices.size(), headerBytes);
+  if (!writer.ok())
+    return false;
+  writer.writeHeader(header, headerBytes);
+  parallelFor(slices.size(),
+              [&](std::size_t t) { writer.writeSlice(t, slices[t], fmt); });
+  return writer.finish();
+}
+
+// "<keyR> <payR> <keyS> <payS>" per merged result row
+struct JoinRecFormat {
+  const JoinRec *rows;
+
+  static constexpr std::size_t maxRowBytes = 2 * 10 + 2 * DATA_LENGTH + 4;
+
+  std::size_t length(std::size_t i) const {
+    const JoinRec &j = rows[i];
+    return decimalLength(j.keyR) + decimalLength(j.keyS) +
+           payloadLength(j.payR) + payloadLength(j.payS) + 4;
+  }
+
+  char *format(std::size_t i, char *p) const {
+    const JoinRec &j = rows[i];
+    p = formatDecimal(p, j.keyR);
+    *p++ = ' ';
+    p = formatPayload(p, j.payR);
+    *p++ = ' ';
+    p = formatDecimal(p, j.keyS);
+    *p++ = ' ';
+    p = formatPayload(p, j.payS);
+    *p++ = '\n';
+    return p;
+  }
+};
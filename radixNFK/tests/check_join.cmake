@@ -0,0 +1,27 @@
+# Runs OblRadix on INPUT with THREADS threads (and the options in ARGS) in the
+# directory WORK and compares the rows of its join.txt, in any order, with the
+# rows of EXPECTED.
+#
+#   cmake -DOBLRADIX=... -DINPUT=... -DEXPECTED=... -DTHREADS=... -DWORK=...
+#         [-DARGS=...] -P check_join.cmake
+
+file(REMOVE_RECURSE "${WORK}")
+file(MAKE_DIRECTORY "${WORK}")
+separate_arguments(args UNIX_COMMAND "${ARGS}")
+execute_process(
+  COMMAND "${OBLRADIX}" ${THREADS} "${INPUT}" ${args}
+  WORKING_DIRECTORY "${WORK}"
+  RESULT_VARIABLE status
+  OUTPUT_FILE "${WORK}/log.txt"
+  ERROR_FILE "${WORK}/log.txt")
+if(NOT status EQUAL 0)
+  message(FATAL_ERROR "OblRadix exited with ${status}, see ${WORK}/log.txt")
+endif()
+
+file(STRINGS "${WORK}/join.txt" got)
+file(STRINGS "${EXPECTED}" expected)
+list(SORT got)
+list(SORT expected)
+if(NOT got STREQUAL expected)
+  message(FATAL_ERROR "join rows differ from ${EXPECTED}:\n${got}")
+endif()